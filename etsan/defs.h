@@ -25,14 +25,71 @@
 #include <atomic>
 #include <algorithm>
 
+// Variable states are kept in direct-mapped shadow memory by default.
+// Build with -DETSAN_HASH_VSTATES to fall back to the global hash map.
+#ifndef ETSAN_HASH_VSTATES
+#include "shadow_memory.h"
+#endif
+
+// Build with -DETSAN_MAX_METADATA_MB=<n> to evict cold variable
+// states once metadata takes more than n MB (shadow memory only).
+#if defined(ETSAN_MAX_METADATA_MB) && defined(ETSAN_HASH_VSTATES)
+#error "ETSAN_MAX_METADATA_MB needs the shadow memory of variable states"
+#endif
+
+#include <type_traits>
+
+#include "spin_lock.h"
+#include "metadata_allocator.h"
+#include "vector_clock.h"
+#include "lock_table.h"
+
+// An epoch c@t packs the id of thread t in its upper ETSAN_TID_BITS
+// and the clock c in the remaining bits. The default compact epoch is
+// an int with 8 bits of tid: at most 256 threads and 16M ticks. Build
+// with -DETSAN_WIDE_EPOCH for 64-bit epochs; the tid/clock split can
+// then be chosen with -DETSAN_TID_BITS (default 16).
+#ifdef ETSAN_WIDE_EPOCH
+using Epoch = long long;
+#ifndef ETSAN_TID_BITS
+#define ETSAN_TID_BITS 16
+#endif
+#else
+using Epoch = int;
+#undef  ETSAN_TID_BITS
+#define ETSAN_TID_BITS 8
+#endif
+
+using UEpoch      = std::make_unsigned<Epoch>::type;
 using Address     = const void *;
 using ThreadID    = unsigned int;
-using VectorClock = std::vector<int>;
-
-#define TID(x) ((x & 0xFF000000) >> 24)
-#define CLOCK(x) (x & (0x00FFFFFF))
+using VectorClock = PaddedVectorClock<Epoch>;
+
+#define CLOCK_BITS (8 * sizeof(Epoch) - ETSAN_TID_BITS)
+#define CLOCK_MASK ((Epoch)((((UEpoch)1) << CLOCK_BITS) - 1))
+#define MAX_THREADS (1UL << ETSAN_TID_BITS)
+
+#define TID(x) ((ThreadID)(((UEpoch)(x)) >> CLOCK_BITS))
+#define CLOCK(x) ((x) & CLOCK_MASK)
+#define EPOCH(tid, clock) ((Epoch)(((UEpoch)(tid) << CLOCK_BITS) | (UEpoch)(clock)))
+
+// Clocks of threads and locks are vector clocks by default. Build with
+// -DETSAN_TREE_CLOCK for tree clocks, whose joins and copies only visit
+// the entries that change (read clocks of variables stay vector clocks).
+#ifdef ETSAN_TREE_CLOCK
+#include "tree_clock.h"
+using ThreadClock = TreeClock<Epoch, CLOCK_MASK>;
+using LockClock   = ThreadClock;
+#else
+using ThreadClock = VectorClock;
+using LockClock   = SharedVectorClock<Epoch>;
+#endif
 
-#define READ_SHARED 0XEFFFFFFF
+#ifdef ETSAN_WIDE_EPOCH
+#define READ_SHARED EPOCH(MAX_THREADS - 1, CLOCK_MASK) // last tid is reserved
+#else
+#define READ_SHARED ((Epoch)0XEFFFFFFF)
+#endif
 
 #define REPORT_RACES 1
 
@@ -47,37 +104,93 @@ using VectorClock = std::vector<int>;
     race_message(msg);	\
     x.Racy = true;    	\
   }               			\
-  VS.mGuard.unlock(); 	\
+  x.Guard.unlock(); 	\
   return;           		\
  }
 
-#define FastPathReturn { VS.mGuard.unlock(); return reportIsRacy;}
+#define FastPathReturn { x.Guard.unlock(); return reportIsRacy;}
 
-// Maybe unnecessary but keeps track of number of parallel
-// threads in the program. Invariant: NumThreads == C.size()
+// Maybe unnecessary but keeps track of number of thread slots
+// in the program. Invariant: NumThreads == C.size()
 static unsigned int NumThreads = 0;
 
+// Bytes of metadata released for freed memory, destroyed locks
+// and joined threads
+std::atomic<unsigned long> ReclaimedBytes{0};
+
 // This variable tracks availability of multiple threads in the program
 // No race is detected if there are no multithreads in the program
 std::atomic_int isConcurrent{0};
 
+// Warns once that epochs can no longer represent the program
+// and that detection from now on may be wrong.
+void warnEpochOverflow(const char *what) {
+  static std::atomic_flag warned = ATOMIC_FLAG_INIT;
+  if (!warned.test_and_set()) {
+    printf("EmbedSanitizer: Warning, too many %s for %d-bit epochs"
+           " (%u tid bits), races may be missed or misreported!\n",
+           what, (int)(8 * sizeof(Epoch)), (unsigned)ETSAN_TID_BITS);
+  }
+}
+
 //////////////////////////////////////////////
 /// Thread state related metadata           //
 //////////////////////////////////////////////
+// Unique ids of thread states, also across reused thread slots
+unsigned long nextThreadUid() {
+  static std::atomic<unsigned long> uids{0};
+  return ++uids;
+}
+
 class ThreadState {
   public:
     unsigned int tid;
-    VectorClock C;
-    int epoch; // invariant: epoch == C[tid]
+    ThreadClock C;
+    Epoch epoch; // invariant: epoch == C[tid]
+
+    // Identity of this thread for the same owner fast path of
+    // locks, and its number of joins of other clocks into C
+    unsigned long uid = nextThreadUid();
+    unsigned long joins = 0;
+
+    // Accesses answered by the lock-free same epoch fast path.
+    // Only updated by the owning thread.
+    unsigned long sameEpochReads = 0;
+    unsigned long sameEpochWrites = 0;
+
+    // Clocks of the fences of this thread (empty if none): Ct at its
+    // last release fence, for its relaxed atomic writes since, and the
+    // join of the sync clocks its relaxed atomic reads saw since its
+    // last acquire fence, for the next one.
+    ThreadClock fenceRelease;
+    ThreadClock fenceAcquire;
+
+    // Whether a thread cached this state as its own, and whether that
+    // thread ended since. Both under the TS lock.
+    bool adopted = false;
+    bool exited = false;
 
     void updateEpoch() { epoch = C[tid]; }
     void increment() {
+      if (CLOCK(epoch) == CLOCK_MASK) warnEpochOverflow("clock ticks");
       epoch++;
       C[tid] = epoch;
       assert(C[tid] == epoch);
     }
 };
 
+// State of the calling thread, cached on its first event so that
+// the per-access callbacks never look it up in TStates again.
+static thread_local ThreadState* CurrentThreadState = nullptr;
+
+// Marks the state of its thread exited when the thread ends, which is
+// before a join of the thread returns and its id can be reused.
+struct ThreadExitMark {
+  ThreadState* state = nullptr;
+  ~ThreadExitMark();
+};
+static thread_local ThreadExitMark CurrentThreadExit;
+
 // This class holds states of all concurrent threads in the system.
 // Has a single lock for each thread for accessing its thread states
 class TStates {
@@ -87,29 +200,76 @@ public:
   // A lock to acquire before accesing thread states C
   std::mutex mGuard; // lock
 
-  // Threads states
+  // Threads states of live threads
   std::unordered_map<ThreadID, ThreadState> C;
+
+  // States of exited threads whose ids new threads reused before the
+  // joins of the exited ones
+  std::unordered_map<ThreadID, ThreadState> Exited;
+
+  // Slot (tid) of a joined thread and the last epoch it used
+  struct FreeSlot {
+    ThreadID tid;
+    Epoch last;
+  };
+
+  // Slots of joined threads waiting to be reused by new threads
+  std::vector<FreeSlot> FreeSlots;
+
+  // Slots handed out so far: tids 0 ... Slots-1
+  unsigned int Slots = 0;
+
+  // Threads ever created
+  unsigned long Created = 0;
+
+  // Fast path counters of joined threads
+  unsigned long retiredSameEpochReads = 0;
+  unsigned long retiredSameEpochWrites = 0;
+
+  // Forgets all threads. NOTE: only for unit tests, the
+  // cached states of threads other than the caller dangle.
+  void clear() {
+    C.clear();
+    Exited.clear();
+    FreeSlots.clear();
+    Slots = 0;
+    Created = 0;
+    retiredSameEpochReads = retiredSameEpochWrites = 0;
+    CurrentThreadState = nullptr;
+    CurrentThreadExit.state = nullptr;
+  }
 //#ifdef STATS
   ~TStates() {
-    printf("Threads: %lu\n", C.size());
+    printf("Threads: %lu\n", Created);
+    printf("Thread slots: %u\n", Slots);
   }
 //#endif
 };
 
 TStates TS; // instance for threads states
 
+ThreadExitMark::~ThreadExitMark() {
+  if (!state) return;
+  TS.mGuard.lock(); // protect
+  state->exited = true;
+  TS.mGuard.unlock(); // release protection
+}
+
 // Updates vector clocks to accomodate vectors of all threads.
 // NOTE: This is a utility function and thus not protected.
 //       Use inside a critical section with the TS lock.
 void UpdateThreadClocks() {
 
-  auto nThreads =  TS.C.size();
+  std::size_t nThreads = TS.Slots;
+  for (auto tv = TS.C.begin(); tv != TS.C.end(); tv++) {
+    nThreads = std::max<std::size_t>(nThreads, tv->second.tid + 1);
+  }
 
   for (auto tv = TS.C.begin(); tv != TS.C.end(); tv++) {
 
     ThreadState& t = tv->second;
     for (auto idx = t.C.size(); idx < nThreads; idx++) {
-      int epoch = idx << 24;
+      Epoch epoch = EPOCH(idx, 0);
       if (t.tid == idx) {
         epoch = epoch + 1;
       }
@@ -118,126 +278,507 @@ void UpdateThreadClocks() {
   } // end for
 }
 
+// Gives the new thread t the slot of a joined thread, if any
+// live thread already knows the last epoch of that thread. The
+// events of the old owner of the slot then happen before those
+// of t, so t can continue the clock of the slot. Returns false
+// if no slot is safe to reuse yet.
+// NOTE: Use inside a critical section with the TS lock.
+bool reuseThreadSlot(ThreadState & t) {
+
+  for (auto slot = TS.FreeSlots.begin(); slot != TS.FreeSlots.end(); slot++) {
+
+    bool caughtUp = true;
+    for (auto tv = TS.C.begin(); tv != TS.C.end() && caughtUp; tv++) {
+      const ThreadState & u = tv->second;
+      if (&u == &t) continue;
+      caughtUp = slot->tid < u.C.size() && u.C[slot->tid] >= slot->last;
+    }
+
+    if (caughtUp) {
+      t.tid = slot->tid;
+      t.epoch = slot->last + 1;
+      TS.FreeSlots.erase(slot);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Frees the slot of the state u of thread "tid", which thread t
+// joined: t knows its last epoch. A later thread reuses the slot
+// instead of growing all clocks.
+// NOTE: Use inside a critical section with the TS lock.
+void freeThreadState(ThreadID tid, ThreadState & u, const ThreadState & t) {
+
+  Epoch last = u.tid < t.C.size() ? t.C[u.tid] : u.epoch;
+  TS.FreeSlots.push_back({ u.tid, last });
+  TS.retiredSameEpochReads  += u.sameEpochReads;
+  TS.retiredSameEpochWrites += u.sameEpochWrites;
+  ReclaimedBytes += sizeof(ThreadState) + u.C.capacity() * sizeof(Epoch);
+
+  auto ev = TS.Exited.find(tid);
+  if (ev != TS.Exited.end() && &ev->second == &u) TS.Exited.erase(ev);
+  else TS.C.erase(tid);
+}
+
+// Returns the State of a thread whose id is tid. If the thread with
+// that id exited, a new thread reuses the id: the exited state waits
+// for its join in TS.Exited and the id gets a fresh state.
+// NOTE: Use inside a critical section with the TS lock.
+ThreadState & findOrAddState(ThreadID tid) {
+
+  auto tv = TS.C.find(tid);
+  if (tv != TS.C.end() && !tv->second.exited) return tv->second;
+
+  if (tv != TS.C.end()) {
+    // never joined, e.g. detached: nothing will join it
+    auto ev = TS.Exited.find(tid);
+    if (ev != TS.Exited.end()) freeThreadState(tid, ev->second, ev->second);
+    TS.Exited[tid] = std::move(tv->second);
+  }
+
+  ThreadState* st = &TS.C[tid];
+  *st = ThreadState();
+  TS.Created++;
+
+  if (!reuseThreadSlot(*st)) {
+    st->tid = TS.Slots++;
+    st->epoch = EPOCH(st->tid, 1);
+    if (st->tid >= MAX_THREADS) warnEpochOverflow("threads");
+  }
+
+  UpdateThreadClocks();
+  ( st->C )[ st->tid ] = st->epoch;
+  NumThreads = TS.Slots; // track # of threads
+  return *st;
+}
+
 // Returns the State of a thread whose id is tid
 ThreadState & getState(ThreadID tid) {
 
-  ThreadState* st;
-
   TS.mGuard.lock(); // protect
+  ThreadState & st = findOrAddState(tid);
+  TS.mGuard.unlock(); // release protection
+  return st;
+}
 
-  if (TS.C.find(tid) == TS.C.end()) {
+// Returns the state of thread "tid" for its join by thread t, if any:
+// the state of the thread that exited, not the one of a new thread
+// that already reuses its id.
+// NOTE: Use inside a critical section with the TS lock.
+ThreadState * findJoinedState(ThreadID tid, const ThreadState & t) {
 
-    TS.C[tid] = ThreadState();
-    st = &TS.C[tid];
-    NumThreads = TS.C.size(); //
-    st->tid = NumThreads;
-    st->epoch = ((st->tid << 24) + 1);
+  auto ev = TS.Exited.find(tid);
+  if (ev != TS.Exited.end()) return &ev->second;
 
-    UpdateThreadClocks();
-    ( st->C )[ st->tid ] = st->epoch;
-    NumThreads = TS.C.size() + 1; // track # of threads
-  } else {
-    st = &TS.C[tid];
-  }
+  auto tv = TS.C.find(tid);
+  if (tv == TS.C.end() || &tv->second == &t) return nullptr;
+
+  // a live thread uses it: the new owner of the id took the state
+  // the joined thread never used
+  if (tv->second.adopted && !tv->second.exited) return nullptr;
+  return &tv->second;
+}
+
+// Frees the slot of thread "tid" once thread t joined it
+void retireThreadState(ThreadID tid, ThreadState & t) {
+
+  TS.mGuard.lock(); // protect
+
+  ThreadState * u = findJoinedState(tid, t);
+  if (u) freeThreadState(tid, *u, t);
 
   TS.mGuard.unlock(); // release protection
-  return *st;
 }
 
 // Returns the State of the current thread
 ThreadState & getThreadState() {
-  ThreadID tid = ( ThreadID )pthread_self();
-  return getState(tid);
+  ThreadState* st = CurrentThreadState;
+  if (!st) {
+    ThreadID tid = ( ThreadID )pthread_self();
+    TS.mGuard.lock(); // protect
+    st = &findOrAddState(tid);
+    st->adopted = true;
+    TS.mGuard.unlock(); // release protection
+    CurrentThreadState = st; // unordered_map nodes never move
+    CurrentThreadExit.state = st;
+  }
+  return *st;
 }
 
 //////////////////////////////////////////////
 /// Variables states related metadata       //
 //////////////////////////////////////////////
+
+// A variable state covers a granule of 4 bytes (a word). Accesses
+// to whole words use it directly. The first access to only a part
+// of a word splits its state into one state per byte, which are
+// used from then on, so that neighbouring bytes do not race.
+#define GRANULE_BITS 2
+#define GRANULE (1 << GRANULE_BITS)
+
 class VarState {
   public:
-    int W, R;
+    std::atomic<Epoch> W{0}, R{0}; // stored under Guard, loaded lock-free
     VectorClock Rvc; // used iff R == READ_SHARED
     bool Racy = false;
+    std::atomic<bool> Used{false}; // set once W and R are initialized
+    SpinLock Guard; // protects all of the above
+
+    // GRANULE byte states once the word is split, set under Guard
+    std::atomic<VarState*> Bytes{nullptr};
+
+    ~VarState() {
+      VarState * bytes = Bytes.load(std::memory_order_relaxed);
+      if (bytes) {
+        for (int i = 0; i < GRANULE; i++) bytes[i].~VarState();
+        MetaAlloc.deallocate(bytes, GRANULE * sizeof(VarState));
+      }
+    }
 };
 
+#ifdef ETSAN_MAX_METADATA_MB
+void enforceMetadataBudget();
+#endif
+
 class VStates {
 
 public:
 
-  // A lock to acquire before accesing VariableStates
+  // A lock to acquire before inserting to Vstates. Each
+  // VarState is protected by its own VarState::Guard.
   std::mutex mGuard;
 
-  // Variables states
-  std::unordered_map<Address, VarState> Vstates;
+  // Variables states, one per word
+#ifdef ETSAN_HASH_VSTATES
+  std::unordered_map<Address, VarState, std::hash<Address>,
+      std::equal_to<Address>,
+      MetadataStlAllocator<std::pair<const Address, VarState>>> Vstates;
+#else
+  ShadowMemory<VarState, GRANULE_BITS> Shadow;
+#endif
+
+#ifdef ETSAN_MAX_METADATA_MB
+  // Used states dropped to stay within the metadata budget
+  std::atomic<unsigned long> evicted{0};
+
+  VStates() {
+    Shadow.beforeGrow = enforceMetadataBudget;
+  }
+#endif
 
 //#ifdef STATS
-  unsigned int reads{0};
-  unsigned int writes{0};
+  std::atomic<unsigned int> reads{0};
+  std::atomic<unsigned int> writes{0};
 
   ~VStates() {
-    printf("Addresses: %lu\n", Vstates.size());
-    printf("Reads: %u\n", (unsigned int)reads);
-    printf("Writes: %u\n", (unsigned int)writes);
+    unsigned long addresses = 0;
     int races = 0;
+    auto count = [&](VarState & x) {
+      if (x.Used) addresses++;
+      if (x.Racy) races++;
+      VarState * bytes = x.Bytes.load(std::memory_order_relaxed);
+      for (int i = 0; bytes && i < GRANULE; i++) {
+        if (bytes[i].Used) addresses++;
+        if (bytes[i].Racy) races++;
+      }
+    };
+#ifdef ETSAN_HASH_VSTATES
     for (auto addr = Vstates.begin(); addr != Vstates.end(); addr++) {
-       if ( ( addr->second ).Racy ) races++;
+      count(addr->second);
     }
+#else
+    Shadow.forEach(count);
+#endif
+    // accesses answered lock-free never reached ft_read/ft_write
+    unsigned long fastReads  = TS.retiredSameEpochReads;
+    unsigned long fastWrites = TS.retiredSameEpochWrites;
+    for (auto & t : TS.C) {
+      fastReads  += t.second.sameEpochReads;
+      fastWrites += t.second.sameEpochWrites;
+    }
+    for (auto & t : TS.Exited) {
+      fastReads  += t.second.sameEpochReads;
+      fastWrites += t.second.sameEpochWrites;
+    }
+    unsigned long allReads  = reads + fastReads;
+    unsigned long allWrites = writes + fastWrites;
+
+    printf("Addresses: %lu\n", addresses);
+    printf("Reads: %lu\n", allReads);
+    printf("Writes: %lu\n", allWrites);
+    printf("Same epoch fast path: %lu reads (%.1f%%), %lu writes (%.1f%%)\n",
+           fastReads, allReads ? 100.0 * fastReads / allReads : 0.0,
+           fastWrites, allWrites ? 100.0 * fastWrites / allWrites : 0.0);
     printf("Races: %d\n", races);
+#ifdef ETSAN_MAX_METADATA_MB
+    printf("Evicted: %lu addresses, %lu re-touched (%.1f%%)\n",
+           evicted.load(), Shadow.retouched(),
+           evicted ? 100.0 * Shadow.retouched() / evicted : 0.0);
+#endif
   }
 //#endif
 };
 
 VStates VS; // instance for variables states
 
+// Sets the first epochs of a memory location accessed by thread t.
+// NOTE: Use inside a critical section with the vs.Guard lock.
+void initVarState(VarState & vs, ThreadState & t, bool isWrite) {
+  vs.W.store(isWrite ? t.epoch : EPOCH(t.tid, 0), std::memory_order_relaxed);
+  vs.R.store(isWrite ? EPOCH(t.tid, 0) : t.epoch, std::memory_order_relaxed);
+  vs.Used.store(true, std::memory_order_release);
+}
+
+// Initializes vs on its first access, by thread t; later
+// accesses take no lock.
+VarState & touchVarState(VarState & vs, ThreadState & t, bool isWrite) {
+  if (!vs.Used.load(std::memory_order_acquire)) {
+    vs.Guard.lock(); // protect
+    if (!vs.Used.load(std::memory_order_relaxed)) {
+      initVarState(vs, t, isWrite);
+    }
+    vs.Guard.unlock(); // release protection
+  }
+  return vs;
+}
+
+// Returns the VarState of the word containing address "addr",
+// creating it if needed, but without initializing it.
+VarState & findVarState(Address addr) {
+
+  Address word = (Address)((uintptr_t)addr & ~(uintptr_t)(GRANULE - 1));
+
+#ifdef ETSAN_HASH_VSTATES
+  VarState* vstt;
+
+  VS.mGuard.lock(); // protect
+  vstt = &VS.Vstates[word];
+  VS.mGuard.unlock(); // release protection
+
+  return *vstt;
+#else
+  // the shadow cell exists already, no lock needed
+  return VS.Shadow.get(word);
+#endif
+}
+
 // Returns VarState instance for a memory address "addr".
-// If none exists already, it creates one and stores in Vstates.
+// If none exists already, it creates and initializes one.
 VarState & getVarState(Address addr, bool isWrite) {
+  return touchVarState(findVarState(addr), getThreadState(), isWrite);
+}
 
-  VarState* vstt;
+// Returns the byte states of word state w, splitting it on first
+// use. Every byte starts with the state of the word, so accesses
+// to the whole word seen so far are kept.
+VarState * splitVarState(VarState & w) {
+
+  VarState * bytes = w.Bytes.load(std::memory_order_acquire);
+  if (bytes) return bytes;
+
+  w.Guard.lock(); // protect
+  bytes = w.Bytes.load(std::memory_order_relaxed);
+  if (!bytes) {
+    bytes = (VarState*)MetaAlloc.allocate(GRANULE * sizeof(VarState));
+    for (int i = 0; i < GRANULE; i++) {
+      VarState & b = *new (&bytes[i]) VarState();
+      if (w.Used.load(std::memory_order_relaxed)) {
+        b.W.store(w.W.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        b.R.store(w.R.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        b.Rvc = w.Rvc;
+        b.Racy = w.Racy;
+        b.Used.store(true, std::memory_order_relaxed);
+      }
+    }
+    w.Bytes.store(bytes, std::memory_order_release);
+  }
+  w.Guard.unlock(); // release protection
+
+  return bytes;
+}
+
+// Bytes of metadata that x owns besides itself
+unsigned long varStateHeapBytes(VarState & x) {
+  unsigned long bytes = x.Rvc.capacity() * sizeof(Epoch);
+  VarState * b = x.Bytes.load(std::memory_order_relaxed);
+  if (b) {
+    bytes += GRANULE * sizeof(VarState);
+    for (int i = 0; i < GRANULE; i++) bytes += b[i].Rvc.capacity() * sizeof(Epoch);
+  }
+  return bytes;
+}
 
+// Drops the states of the words of [addr, addr+size), which the
+// program released (free, delete, munmap). A later allocation at
+// the same addresses then starts afresh instead of inheriting
+// epochs of the old object.
+void reclaimVarStates(Address addr, std::size_t size) {
+
+  const uintptr_t begin = (uintptr_t)addr;
+  const uintptr_t end = begin + size;
+  unsigned long reclaimed = 0;
+
+#ifdef ETSAN_HASH_VSTATES
   VS.mGuard.lock(); // protect
 
-  if (VS.Vstates.find(addr) == VS.Vstates.end()) {
-    ThreadState & t = getThreadState();
-    VarState vs;
-    vs.W = (t.tid << 24);
-    vs.R = (t.tid << 24);
-    if (isWrite) {
-      vs.W = t.epoch;
-    } else {
-      vs.R = t.epoch;
+  auto drop = [&](decltype(VS.Vstates)::iterator vs) {
+    reclaimed += sizeof(*vs) + varStateHeapBytes(vs->second);
+    return VS.Vstates.erase(vs);
+  };
+  if (size / GRANULE < VS.Vstates.size()) {
+    uintptr_t word = (begin + GRANULE - 1) & ~(uintptr_t)(GRANULE - 1);
+    for (; word + GRANULE <= end; word += GRANULE) {
+      auto vs = VS.Vstates.find((Address)word);
+      if (vs != VS.Vstates.end()) drop(vs);
     }
-    VS.Vstates[addr] = vs;
-    vstt = &VS.Vstates[addr];
   } else {
-    vstt = &VS.Vstates[addr];
+    for (auto vs = VS.Vstates.begin(); vs != VS.Vstates.end(); ) {
+      uintptr_t word = (uintptr_t)vs->first;
+      vs = (word >= begin && word + GRANULE <= end) ? drop(vs) : std::next(vs);
+    }
   }
+
   VS.mGuard.unlock(); // release protection
+#else
+  reclaimed = VS.Shadow.reset(addr, (Address)end, [&](VarState & x) {
+    ReclaimedBytes += varStateHeapBytes(x);
+  });
+#endif
 
-  return *vstt;
+  ReclaimedBytes += reclaimed;
+}
+
+#ifdef ETSAN_MAX_METADATA_MB
+// Empties the states of a cold shadow page so that it can be
+// evicted, and marks the used ones in bitmap "used". The states
+// stay locked while the page is zero-filled, which unlocks them,
+// so no thread is inside a critical section meanwhile. Pages with
+// split words are only reset: a thread may still read their byte
+// states without a lock.
+bool evictVarStates(VarState * cells, decltype(VS.Shadow)::Bitmap * used) {
+
+  const auto n = VS.Shadow.kCellsPerPage;
+  bool zeroFill = true;
+  unsigned long evicted = 0;
+
+  for (std::size_t i = 0; i < n; i++) {
+    VarState & x = cells[i];
+    x.Guard.lock();
+    if (x.Used.load(std::memory_order_relaxed) || x.Bytes.load(std::memory_order_relaxed)) {
+      used[i >> 5].fetch_or(1u << (i & 31), std::memory_order_relaxed);
+      evicted++;
+    }
+    if (x.Bytes.load(std::memory_order_relaxed)) zeroFill = false;
+  }
+
+  for (std::size_t i = 0; i < n; i++) {
+    VarState & x = cells[i];
+    VectorClock().swap(x.Rvc);
+    if (zeroFill) continue;
+
+    VarState * bytes = x.Bytes.load(std::memory_order_relaxed);
+    for (int b = 0; bytes && b < GRANULE; b++) {
+      bytes[b].Guard.lock();
+      bytes[b].Used.store(false, std::memory_order_relaxed);
+      bytes[b].W.store(0, std::memory_order_relaxed);
+      bytes[b].R.store(0, std::memory_order_relaxed);
+      VectorClock().swap(bytes[b].Rvc);
+      bytes[b].Racy = false;
+      bytes[b].Guard.unlock();
+    }
+    x.Used.store(false, std::memory_order_relaxed);
+    x.W.store(0, std::memory_order_relaxed);
+    x.R.store(0, std::memory_order_relaxed);
+    x.Racy = false;
+    x.Guard.unlock();
+  }
+
+  VS.evicted += evicted;
+  return zeroFill;
 }
 
+// Evicts cold variable states if one more shadow page would exceed
+// the metadata budget, down to 7/8 of it, so that eviction does not
+// run on every page.
+void enforceMetadataBudget() {
+  const unsigned long budget = ETSAN_MAX_METADATA_MB * 1024UL * 1024UL;
+  const unsigned long inUse = MetaAlloc.bytesInUse() + VS.Shadow.residentBytes()
+      + VS.Shadow.kCellsPerPage * sizeof(VarState);
+  if (inUse > budget) {
+    VS.Shadow.evict(inUse - budget / 8 * 7, evictVarStates);
+  }
+}
+#endif
+
 //////////////////////////////////////////////
 /// Locks state related metadata          //
 //////////////////////////////////////////////
 class LockState {
   public:
-    VectorClock L;
+    LockClock L; // shares the clock of the last releaser
+
+    // Last releaser (uid, 0 if none) and its number of joins then
+    unsigned long releaserUid = 0;
+    unsigned long releaserJoins = 0;
+
+    // Guards L, so that only threads using the same lock wait
+    // for each other in ft_acquire() and ft_release()
+    SpinLock Guard;
+};
+
+// State of a reader-writer lock. Writers join W and R, readers
+// join only W, so readers do not order each other.
+class RWLockState {
+  public:
+    LockClock W;   // shares the clock of the last writer release
+    ThreadClock R; // reader releases since, empty if none
+
+    bool writing = false; // held by a writer: unlock is its release
+
+    // Guards the clocks, as in LockState
+    SpinLock Guard;
+};
+
+// State of a condition variable: signals and broadcasts join the
+// clock of the signaler into S, waiters that wake up join S.
+class CondState {
+  public:
+    ThreadClock S; // all signals so far, empty if none
+
+    // Guards S, as in LockState
+    SpinLock Guard;
+};
+
+// State of a barrier. The threads of a generation join their clocks
+// into Arrived, the last one to arrive moves it to Departed, which
+// each of them joins when it leaves the barrier.
+class BarrierState {
+  public:
+    unsigned count = 0;   // threads per generation, 0 if unknown
+    unsigned arrived = 0; // threads of the current generation so far
+    ThreadClock Arrived;  // their clocks joined, empty if none
+    ThreadClock Departed; // the joined clocks of the last generation
+
+    // Guards the fields, as in LockState
+    SpinLock Guard;
 };
 
 class LStates {
 
 public:
 
-  // A lock to acquire before accesing LockStates
-  std::mutex mGuard;
-
-  // Locks states
-  std::unordered_map<Address, LockState> L;
+  // Locks states, found without a lock (see lock_table.h)
+  LockTable<LockState> L;
+  LockTable<RWLockState> RW;
+  LockTable<CondState> CV;
+  LockTable<BarrierState> B;
+  LockTable<LockState> A; // sync clocks of atomic locations
 
 //#ifdef STATS
   ~LStates() {
-    printf("Locks: %lu\n", L.size());
+    printf("Locks: %lu\n", L.size() + RW.size());
   }
 //#endif
 };
@@ -246,26 +787,29 @@ LStates LS; // instance for locks states metadata
 
 // Initializes clocks in the vector clock to 0
 // for all threads 0 ... size-1 for a vector clock VC
-void newVectorClock(VectorClock& VC, int size) {
+template <typename Clock>
+void newVectorClock(Clock& VC, int size) {
   VC.resize( size );
   for (int t = 0; t < size; t++) {
-    VC[t] = (t << 24); // =0?
+    VC[t] = EPOCH(t, 0); // =0?
   }
 }
 
 // Updates vector clock to accomodate epochs of new dynamically created threads
-void ExtendVectorClock(VectorClock& C, int totalThreads) {
+template <typename Clock>
+void ExtendVectorClock(Clock& C, int totalThreads) {
 
   int tid = C.size();
   for (; tid < totalThreads; tid++) {
-    int epoch = tid << 24;
+    Epoch epoch = EPOCH(tid, 0);
     C.push_back(epoch);
   }
 }
 
 // Makes sure to extend two Vector clocks C1 and C2 to be of same
 // length by appending zeros.
-void ExtendVectorClocks(VectorClock& C1, VectorClock& C2) {
+template <typename Clock1, typename Clock2>
+void ExtendVectorClocks(Clock1& C1, Clock2& C2) {
   int t_size = C1.size();
   int l_size = C2.size();
 
@@ -275,23 +819,105 @@ void ExtendVectorClocks(VectorClock& C1, VectorClock& C2) {
   ExtendVectorClock(C2, size);
 }
 
+// Gives a new lock state a clock of all threads
+void initLockState(LockState & lock) {
+  newVectorClock(lock.L, NumThreads);
+}
+
 // Returns vector clock state of a lock whose address is "lock"
 LockState& getLockState(Address lock) {
+  return LS.L.get(lock, initLockState);
+}
 
-  LockState* lockS;
+// Drops the state of a destroyed lock
+void reclaimLockState(Address lock) {
+  LS.L.erase(lock, [](LockState & lockS) {
+    ReclaimedBytes += sizeof(lockS) + lockS.L.capacity() * sizeof(Epoch);
+  });
+}
 
-  LS.mGuard.lock(); // protect access
+// Returns the sync clock state of the atomic location "addr"
+LockState& getAtomicState(Address addr) {
+  return LS.A.get(addr, initLockState);
+}
 
-  if (LS.L.find(lock) == LS.L.end()) {
-    LS.L[lock] = LockState();
-    newVectorClock(LS.L[lock].L, NumThreads);
-  }
+// Returns the sync clock state of the atomic location "addr", if any
+LockState* findAtomicState(Address addr) {
+  return LS.A.find(addr);
+}
 
-  lockS = &LS.L[lock];
+// Gives a new reader-writer lock state a writer clock of all threads
+void initRWLockState(RWLockState & lock) {
+  newVectorClock(lock.W, NumThreads);
+}
 
-  LS.mGuard.unlock(); // release lock
+// Returns vector clock state of a reader-writer lock at "lock"
+RWLockState& getRWLockState(Address lock) {
+  return LS.RW.get(lock, initRWLockState);
+}
+
+// Drops the state of a destroyed reader-writer lock
+void reclaimRWLockState(Address lock) {
+  LS.RW.erase(lock, [](RWLockState & lockS) {
+    ReclaimedBytes += sizeof(lockS) +
+      (lockS.W.capacity() + lockS.R.capacity()) * sizeof(Epoch);
+  });
+}
+
+// Returns vector clock state of a condition variable at "cond"
+CondState& getCondState(Address cond) {
+  return LS.CV.get(cond, [](CondState &) {});
+}
+
+// Drops the state of a destroyed condition variable
+void reclaimCondState(Address cond) {
+  LS.CV.erase(cond, [](CondState & condS) {
+    ReclaimedBytes += sizeof(condS) + condS.S.capacity() * sizeof(Epoch);
+  });
+}
+
+// Returns vector clock state of a barrier at "barrier"
+BarrierState& getBarrierState(Address barrier) {
+  return LS.B.get(barrier, [](BarrierState &) {});
+}
+
+// Sets the number of threads that "barrier" waits for
+void initBarrierState(Address barrier, unsigned count) {
+  BarrierState & b = getBarrierState(barrier);
+  b.Guard.lock();
+  b.count = count;
+  b.arrived = 0;
+  b.Guard.unlock();
+}
 
-  return *lockS;
+// Drops the state of a destroyed barrier
+void reclaimBarrierState(Address barrier) {
+  LS.B.erase(barrier, [](BarrierState & b) {
+    ReclaimedBytes += sizeof(b) +
+      (b.Arrived.capacity() + b.Departed.capacity()) * sizeof(Epoch);
+  });
 }
 
+// Reports the memory taken by race detection metadata. Defined
+// last, so it is destroyed, and prints, before the states above
+// release their metadata at exit.
+class MetadataStats {
+
+public:
+
+//#ifdef STATS
+  ~MetadataStats() {
+    unsigned long shadow = 0;
+#ifndef ETSAN_HASH_VSTATES
+    shadow = VS.Shadow.residentBytes();
+#endif
+    printf("Metadata: %lu bytes in use (%lu bytes mapped, %lu bytes of shadow)\n",
+           MetaAlloc.bytesInUse() + shadow, MetaAlloc.bytesMapped(), shadow);
+    printf("Reclaimed metadata: %lu bytes\n", ReclaimedBytes.load());
+  }
+//#endif
+};
+
+MetadataStats MS; // prints metadata usage at exit
+
 #endif // FT_DEFS_H
@@ -25,46 +25,60 @@ bool ft_write(VarState & x, ThreadState & t);
 bool ft_read(VarState & x, ThreadState & t) {
 
   bool reportIsRacy = false;
-  VS.mGuard.lock(); // protect
+  x.Guard.lock(); // protect
 // #ifdef STATS
-  VS.reads++;
+  VS.reads.fetch_add(1, std::memory_order_relaxed);
 // #endif
 
   if (x.Racy) FastPathReturn;
+#ifdef ETSAN_MAX_METADATA_MB
+  // evicted (zero-filled) since the caller touched it: first access
+  if (!x.Used.load(std::memory_order_relaxed)) {
+    initVarState(x, t, false);
+    FastPathReturn;
+  }
+#endif
+
+  // W and R are only modified under x.Guard; the lock-free
+  // same epoch check in ft_same_epoch_read() reads R without it.
+  Epoch W = x.W.load(std::memory_order_relaxed);
+  Epoch R = x.R.load(std::memory_order_relaxed);
 
-  if (x.R == t.epoch) FastPathReturn;  // Same epoch 63.4%
+  if (R == t.epoch) FastPathReturn;  // Same epoch 63.4%
 
   // write-read race?
-  if ( TID(x.W) != t.tid && CLOCK(x.W) > CLOCK( t.C[TID(x.W)] ) ) {
+  if ( TID(W) != t.tid && CLOCK(W) > CLOCK( t.C[TID(W)] ) ) {
 #ifdef DEBUG
-    printf("x.tid: %d, t.tid: %d\n", TID(x.W), t.tid);
+    printf("x.tid: %u, t.tid: %u\n", TID(W), t.tid);
 #endif
     reportIsRacy = true;
   }
 
   // update read state
-  if (x.R == READ_SHARED) {            // Shared     20.8%
+  if (R == READ_SHARED) {            // Shared     20.8%
 
+    ExtendVectorClock(x.Rvc, t.tid + 1); // thread slots may have grown
     x.Rvc[t.tid] = t.epoch;
 
   } else {
 
-    if (x.R <= t.C[TID(x.R)]) {        // Exclusive  15.7%
+    if (R <= t.C[TID(R)]) {        // Exclusive  15.7%
 
-      x.R = t.epoch;
+      x.R.store(t.epoch, std::memory_order_relaxed);
 
     } else {                          // Share       0.1%
 
       if(x.Rvc.size() == 0) {
         newVectorClock(x.Rvc, NumThreads);     // (SLOW PATH)
       }
-      x.Rvc[TID(x.R)] = x.R;
+      ExtendVectorClock(x.Rvc, std::max(t.tid, TID(R)) + 1);
+      x.Rvc[TID(R)] = R;
       x.Rvc[t.tid] = t.epoch;
-      x.R = READ_SHARED;
+      x.R.store(READ_SHARED, std::memory_order_relaxed);
     }
   }
 
-  VS.mGuard.unlock(); // release protection
+  x.Guard.unlock(); // release protection
 
   return reportIsRacy;
 }
@@ -76,24 +90,34 @@ bool ft_read(VarState & x, ThreadState & t) {
 bool ft_write(VarState & x, ThreadState & t) {
 
   bool reportIsRacy = false;
-  VS.mGuard.lock(); // protection
+  x.Guard.lock(); // protection
 
 // #ifdef STATS
-  VS.writes++;
+  VS.writes.fetch_add(1, std::memory_order_relaxed);
 // #endif
 
   if (x.Racy) FastPathReturn; // should already have been reported
+#ifdef ETSAN_MAX_METADATA_MB
+  // evicted (zero-filled) since the caller touched it: first access
+  if (!x.Used.load(std::memory_order_relaxed)) {
+    initVarState(x, t, true);
+    FastPathReturn;
+  }
+#endif
 
-  if (x.W == t.epoch) FastPathReturn;     // Same epoch 71.0%
+  Epoch W = x.W.load(std::memory_order_relaxed);
+  Epoch R = x.R.load(std::memory_order_relaxed);
+
+  if (W == t.epoch) FastPathReturn;     // Same epoch 71.0%
 
   // write-write race?
-  if ( TID(x.W) != t.tid && CLOCK(x.W) > CLOCK( t.C[TID(x.W)] ) ) {
+  if ( TID(W) != t.tid && CLOCK(W) > CLOCK( t.C[TID(W)] ) ) {
     reportIsRacy = true;
   }
 
   // read-write race?
-  if (x.R != READ_SHARED) {   // Write Exclusive 28.9%
-    if (TID(x.R) != t.tid && CLOCK(x.R) > CLOCK(t.C[TID(x.R)]) ) {
+  if (R != READ_SHARED) {   // Write Exclusive 28.9%
+    if (TID(R) != t.tid && CLOCK(R) > CLOCK(t.C[TID(R)]) ) {
       reportIsRacy = true;
     }
   } else {                       // Write Shared       0.1%
@@ -103,61 +127,404 @@ bool ft_write(VarState & x, ThreadState & t) {
       }
     }
     // also have to set R = epoch
-    x.R = (TID(t.epoch) << 24); // 0@tid
+    x.R.store(EPOCH(TID(t.epoch), 0), std::memory_order_relaxed); // 0@tid
   } // a possible bug.
 
-  x.W = t.epoch; // update write state
-  VS.mGuard.unlock(); // release protection
+  x.W.store(t.epoch, std::memory_order_relaxed); // update write state
+  x.Guard.unlock(); // release protection
 
   return reportIsRacy;
 }
 
+// Lock-free check whether thread t already read x in its current
+// epoch. Only t stores t.epoch to x.R, so a match is never stale;
+// such a read is redundant and needs neither x.Guard nor ft_read.
+inline bool ft_same_epoch_read(VarState & x, ThreadState & t) {
+  return x.R.load(std::memory_order_relaxed) == t.epoch;
+}
 
-void ft_acquire(ThreadState& t, LockState& lock) {
+// Lock-free check whether thread t already wrote x in its current epoch
+inline bool ft_same_epoch_write(VarState & x, ThreadState & t) {
+  return x.W.load(std::memory_order_relaxed) == t.epoch;
+}
 
-  LS.mGuard.lock(); // protect
+// Checks an access of thread t to a single variable state x,
+// trying the lock-free same epoch check first.
+inline bool ft_access_state(VarState & x, ThreadState & t, bool isWrite) {
+  touchVarState(x, t, isWrite);
+  if (isWrite) {
+    if (ft_same_epoch_write(x, t)) { t.sameEpochWrites++; return false; }
+    return ft_write(x, t);
+  }
+  if (ft_same_epoch_read(x, t)) { t.sameEpochReads++; return false; }
+  return ft_read(x, t);
+}
 
-  ExtendVectorClocks(t.C, lock.L);
+// Checks an access of thread t to the whole word of state w. If w
+// was split, or gets split meanwhile, its byte states are checked.
+inline bool ft_access_word(VarState & w, ThreadState & t, bool isWrite) {
+  bool isRacy = false;
+  VarState * bytes = w.Bytes.load(std::memory_order_acquire);
+  if (!bytes) {
+    isRacy = ft_access_state(w, t, isWrite);
+    bytes = w.Bytes.load(std::memory_order_acquire);
+    if (!bytes) return isRacy;
+  }
+  for (int i = 0; i < GRANULE; i++) {
+    isRacy |= ft_access_state(bytes[i], t, isWrite);
+  }
+  return isRacy;
+}
+
+// Checks an access of thread t to "size" bytes at "addr". Aligned
+// words are checked as one state each; the bytes of partly
+// accessed words are checked on their own.
+// @return true if there is a race on any of the bytes.
+inline bool ft_access(Address addr, std::size_t size, ThreadState & t, bool isWrite) {
+  bool isRacy = false;
+  uintptr_t a = (uintptr_t)addr;
+  const uintptr_t end = a + size;
+
+  while (a < end) {
+    const uintptr_t word = a & ~(uintptr_t)(GRANULE - 1);
+    VarState & w = findVarState((Address)word);
+
+    if (a == word && end - a >= GRANULE) {
+      isRacy |= ft_access_word(w, t, isWrite);
+      a += GRANULE;
+    } else {
+      VarState * bytes = splitVarState(w);
+      const uintptr_t stop = std::min(end, word + GRANULE);
+      for (; a < stop; a++) {
+        isRacy |= ft_access_state(bytes[a - word], t, isWrite);
+      }
+    }
+  }
+  return isRacy;
+}
+
+// Performs race detection for a read of "size" bytes at "addr"
+inline bool ft_read(Address addr, std::size_t size, ThreadState & t) {
+  return ft_access(addr, size, t, false);
+}
+
+// Performs race detection for a write of "size" bytes at "addr"
+inline bool ft_write(Address addr, std::size_t size, ThreadState & t) {
+  return ft_access(addr, size, t, true);
+}
+
+// Checks an access of thread t to a whole range of "size" bytes at
+// "addr", e.g. all the elements a loop accesses in one epoch. Like
+// ft_access, but the shadow is walked page by page for the aligned
+// words inside the range.
+inline bool ft_access_range(Address addr, std::size_t size, ThreadState & t,
+                            bool isWrite) {
+#ifdef ETSAN_HASH_VSTATES
+  return ft_access(addr, size, t, isWrite);
+#else
+  const uintptr_t a = (uintptr_t)addr, end = a + size;
+  const uintptr_t first = (a + GRANULE - 1) & ~(uintptr_t)(GRANULE - 1);
+  const uintptr_t last = end & ~(uintptr_t)(GRANULE - 1);
+  if (first >= last) return ft_access(addr, size, t, isWrite);
+
+  bool isRacy = false;
+  if (a < first) isRacy |= ft_access(addr, first - a, t, isWrite);
+  VS.Shadow.getRange((Address)first, (Address)last, [&](VarState & w) {
+    isRacy |= ft_access_word(w, t, isWrite);
+  });
+  if (last < end) isRacy |= ft_access((Address)last, end - last, t, isWrite);
+  return isRacy;
+#endif
+}
+
+// Ct := Ct U Lm. NOTE: the caller holds lock.Guard.
+inline void acquireClock(ThreadState& t, LockState& lock) {
+
+  // Same owner: t released Lm last, so Ct already covers it
+  if (lock.releaserUid == t.uid) return;
+
+  if (t.C.size() != lock.L.size()) ExtendVectorClocks(t.C, lock.L);
 
   // Join: Ct := Ct U Lm
-  for (std::size_t i = 0; i < lock.L.size(); i++) {
-    t.C[i] = std::max(t.C[i], lock.L[i]);
+  lock.L.joinInto(t.C);
+  t.joins++;
+}
+
+// Lm := Ct. NOTE: the caller holds lock.Guard.
+inline void releaseClock(ThreadState& t, LockState& lock) {
+
+  if (lock.releaserUid == t.uid && lock.releaserJoins == t.joins) {
+
+    // Same owner, no joins since its last release of the lock:
+    // only the entry of t changed in Ct
+    lock.L.advance(t.tid, t.epoch);
+    return;
   }
 
-  LS.mGuard.unlock(); // release protection
+  if (lock.L.size() > t.C.size()) ExtendVectorClock(t.C, lock.L.size());
+
+  // Copy: Lm := Ct. A vector clock Ct is shared, not copied, and gets
+  // its own buffer again at its next join, not at the increment below.
+  lock.L.copyFrom(t.C, t.tid);
+
+  lock.releaserUid = t.uid;
+  lock.releaserJoins = t.joins;
+}
+
+void ft_acquire(ThreadState& t, LockState& lock) {
+
+  lock.Guard.lock(); // protect
+  acquireClock(t, lock);
+  lock.Guard.unlock(); // release protection
 
   t.updateEpoch(); // invariant
 }
 
 void ft_release(ThreadState& t, LockState& lock) {
 
-  LS.mGuard.lock(); // protect
+  lock.Guard.lock(); // protect
+  releaseClock(t, lock);
+  lock.Guard.unlock(); // release protection
+
+  t.updateEpoch(); // invariant
+  t.increment();
+}
+
+// Synchronization of an atomic operation, as bits of its memory order,
+// and what the operation did to the location
+enum AtomicSync {
+  kAtomicRelaxed = 0,
+  kAtomicAcquire = 1,
+  kAtomicRelease = 2,
+  kAtomicRead    = 4,
+  kAtomicWrite   = 8
+};
+
+// Performs the atomic operation op on a location with sync clock
+// "sync". op runs under the guard of the location, so that its value
+// and clock change together, and returns the AtomicSync bits of its
+// order (a compare-exchange has one on success and one on failure)
+// and of its access, if it may synchronize through fences.
+// A release store replaces the clock; a read-modify-write joins it,
+// as it continues the release sequence of the earlier stores.
+template <typename Op>
+void ft_atomic(ThreadState& t, LockState& sync, bool rmw, Op op) {
+
+  sync.Guard.lock(); // protect
+
+  const int order = op();
+  if (order & kAtomicAcquire) acquireClock(t, sync);
+  if ((order & kAtomicRelease) && !rmw) {
+    releaseClock(t, sync);
+  } else if (order & kAtomicRelease) {
+    if (sync.L.size() < t.C.size()) ExtendVectorClock(sync.L, t.C.size());
+
+    // Join: Lm := Lm U Ct, which no later release of t can advance
+    sync.L.join(t.C);
+    sync.releaserUid = 0;
+  }
+
+  // A relaxed read is acquired by the next acquire fence of t
+  if ((order & kAtomicRead) && !(order & kAtomicAcquire)) {
+    if (t.fenceAcquire.size() != sync.L.size()) {
+      ExtendVectorClocks(t.fenceAcquire, sync.L);
+    }
+    sync.L.joinInto(t.fenceAcquire);
+  }
+
+  // A relaxed write releases Ct at the last release fence of t
+  if ((order & kAtomicWrite) && !(order & kAtomicRelease) &&
+      !t.fenceRelease.empty()) {
+    if (sync.L.size() < t.fenceRelease.size()) {
+      ExtendVectorClock(sync.L, t.fenceRelease.size());
+    }
+    if (rmw) sync.L.join(t.fenceRelease);
+    else sync.L.copyFrom(t.fenceRelease, t.tid);
+    sync.releaserUid = 0;
+  }
+
+  sync.Guard.unlock(); // release protection
+
+  t.updateEpoch(); // invariant
+  if (order & kAtomicRelease) t.increment();
+}
+
+// Whether a relaxed atomic access of t to location "a" may synchronize
+// through the fences of t: a write after a release fence, or a read of
+// a location with a sync clock.
+inline bool ft_fenced(ThreadState& t, Address a, int access) {
+  return ((access & kAtomicWrite) && !t.fenceRelease.empty()) ||
+         ((access & kAtomicRead) && findAtomicState(a));
+}
+
+// Fence of t with the AtomicSync bits "order". An acquire fence joins
+// the clocks its earlier relaxed reads saw; a release fence keeps Ct
+// for its later relaxed writes.
+void ft_fence(ThreadState& t, int order) {
+
+  if ((order & kAtomicAcquire) && !t.fenceAcquire.empty()) {
+    if (t.C.size() < t.fenceAcquire.size()) {
+      ExtendVectorClock(t.C, t.fenceAcquire.size());
+    }
+
+    // Join: Ct := Ct U Ft, which Ct then covers
+    t.C.join(t.fenceAcquire);
+    t.joins++;
+    t.fenceAcquire = ThreadClock();
+    t.updateEpoch(); // invariant
+  }
+
+  if (order & kAtomicRelease) {
+    t.fenceRelease = t.C;
+    t.increment();
+  }
+}
+
+// Acquire of a reader-writer lock: readers join the last writer
+// release, writers also join all reader releases since.
+void ft_acquire(ThreadState& t, RWLockState& lock, bool write) {
+
+  lock.Guard.lock(); // protect
+
+  if (t.C.size() != lock.W.size()) ExtendVectorClocks(t.C, lock.W);
+
+  // Join: Ct := Ct U Wm
+  lock.W.joinInto(t.C);
+
+  if (write) {
+    if (t.C.size() < lock.R.size()) ExtendVectorClock(t.C, lock.R.size());
 
-  ExtendVectorClocks(t.C, lock.L);
+    // Join: Ct := Ct U Rm
+    if (!lock.R.empty()) t.C.join(lock.R);
+    lock.writing = true;
+  }
+  t.joins++;
+
+  lock.Guard.unlock(); // release protection
+
+  t.updateEpoch(); // invariant
+}
+
+// Release of a reader-writer lock, by its writer if it is held
+// for writing, else by one of its readers
+void ft_release(ThreadState& t, RWLockState& lock) {
+
+  lock.Guard.lock(); // protect
+
+  if (lock.writing) {
+    if (lock.W.size() > t.C.size()) ExtendVectorClock(t.C, lock.W.size());
+
+    // Copy: Wm := Ct. Ct covers the reader releases: Rm := empty
+    lock.W.copyFrom(t.C, t.tid);
+    lock.R = ThreadClock();
+    lock.writing = false;
+  } else {
+    if (lock.R.size() < t.C.size()) ExtendVectorClock(lock.R, t.C.size());
+
+    // Join: Rm := Rm U Ct
+    lock.R.join(t.C);
+  }
+
+  lock.Guard.unlock(); // release protection
+
+  t.updateEpoch(); // invariant
+  t.increment();
+}
+
+// Signal or broadcast of a condition variable
+void ft_signal(ThreadState& t, CondState& cond) {
+
+  cond.Guard.lock(); // protect
+
+  if (cond.S.size() < t.C.size()) ExtendVectorClock(cond.S, t.C.size());
+
+  // Join: Sc := Sc U Ct
+  cond.S.join(t.C);
+
+  cond.Guard.unlock(); // release protection
+
+  t.updateEpoch(); // invariant
+  t.increment();
+}
+
+// Wake up of a waiter of a condition variable
+void ft_wait(ThreadState& t, CondState& cond) {
+
+  cond.Guard.lock(); // protect
+
+  if (t.C.size() < cond.S.size()) ExtendVectorClock(t.C, cond.S.size());
+
+  // Join: Ct := Ct U Sc
+  if (!cond.S.empty()) {
+    t.C.join(cond.S);
+    t.joins++;
+  }
+
+  cond.Guard.unlock(); // release protection
+
+  t.updateEpoch(); // invariant
+}
 
-  // Copy: Lm := Ct
-  for (std::size_t i = 0; i < lock.L.size(); i++) {
-    lock.L[i] = t.C[i];
+// Arrival of a thread at a barrier: a release into the generation.
+// The last thread to arrive ends the generation, so that all of its
+// threads leave with one n-way join instead of pairwise ones.
+void ft_arrive(ThreadState& t, BarrierState& barrier) {
+
+  barrier.Guard.lock(); // protect
+
+  if (barrier.Arrived.size() < t.C.size()) {
+    ExtendVectorClock(barrier.Arrived, t.C.size());
+  }
+
+  // Join: Ab := Ab U Ct
+  barrier.Arrived.join(t.C);
+
+  if (barrier.count != 0 && ++barrier.arrived == barrier.count) {
+    // Move: Db := Ab, Ab := empty
+    barrier.Departed = std::move(barrier.Arrived);
+    barrier.Arrived = ThreadClock();
+    barrier.arrived = 0;
   }
 
-  LS.mGuard.unlock(); // release protection
+  barrier.Guard.unlock(); // release protection
 
   t.updateEpoch(); // invariant
   t.increment();
 }
 
+// Departure of a thread from a barrier, after all threads of its
+// generation arrived. With an unknown count of threads it joins all
+// arrivals so far.
+void ft_depart(ThreadState& t, BarrierState& barrier) {
+
+  barrier.Guard.lock(); // protect
+
+  const ThreadClock & D =
+    barrier.count != 0 ? barrier.Departed : barrier.Arrived;
+  if (t.C.size() < D.size()) ExtendVectorClock(t.C, D.size());
+
+  // Join: Ct := Ct U Db
+  if (!D.empty()) {
+    t.C.join(D);
+    t.joins++;
+  }
+
+  barrier.Guard.unlock(); // release protection
+
+  t.updateEpoch(); // invariant
+}
+
 void ft_fork(ThreadState & t, ThreadState & u){
 
   isConcurrent++;
 
   TS.mGuard.lock();
 
-  ExtendVectorClocks(t.C, u.C);
+  if (t.C.size() != u.C.size()) ExtendVectorClocks(t.C, u.C);
 
   // Join: Cu := Cu U Ct
-  for (std::size_t i = 0; i < u.C.size(); i++) {
-    u.C[i] = std::max(u.C[i], t.C[i]);
-  }
+  u.C.join(t.C);
+  u.joins++;
 
   u.updateEpoch(); // invariant
 
@@ -167,6 +534,19 @@ void ft_fork(ThreadState & t, ThreadState & u){
 }
 
 
+// Ct := Ct U Cu. NOTE: the caller holds the TS lock.
+inline void joinThreadClock(ThreadState & t, ThreadState & u) {
+
+  if (t.C.size() != u.C.size()) ExtendVectorClocks(t.C, u.C);
+
+  // Join: Ct := Ct U Cu
+  t.C.join(u.C);
+  t.joins++;
+
+  t.updateEpoch(); // invariant
+  u.increment(); // child state
+}
+
 void ft_join(ThreadState & t, ThreadState & u){
 
   if ( isConcurrent ) isConcurrent--;
@@ -176,22 +556,26 @@ void ft_join(ThreadState & t, ThreadState & u){
 #endif
 
   TS.mGuard.lock();
+  joinThreadClock(t, u);
+  TS.mGuard.unlock(); // release protection
+}
 
-  ExtendVectorClocks(t.C, u.C);
+// Join of thread "tid" by t, which also frees the slot of tid. Both
+// happen in one critical section, after the joined thread ended: a new
+// thread that already reuses the id keeps its own, fresh state.
+void ft_join(ThreadState & t, ThreadID tid){
 
-  // Join: Ct := Ct U Cu
-  for (std::size_t i = 0; i < t.C.size(); i++) {
-    t.C[i] = std::max(t.C[i], u.C[i]);
-  }
+  if ( isConcurrent ) isConcurrent--;
 
-  t.updateEpoch(); // invariant
-  u.increment(); // child state
+  TS.mGuard.lock();
 
-  TS.mGuard.unlock(); // release protection
-}
+  ThreadState * u = findJoinedState(tid, t);
+  if (u) {
+    joinThreadClock(t, *u);
+    freeThreadState(tid, *u, t);
+  }
 
-void ft_atomic_load() {
-  printf("EmbedSanitizer: Warning, atomic load not implemented!\n");
+  TS.mGuard.unlock(); // release protection
 }
 
 #endif // FASTTRACK_HPP_
@@ -0,0 +1,254 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Concurrent table of lock states, keyed by the address of the lock.
+//
+// Open addressing with linear probing over segments of slots. Lookups
+// take no lock. A new lock claims a free slot with a CAS on its key,
+// so threads using different locks never wait for each other here.
+// A full segment is sealed and a twice as large one is chained after
+// it; only this growth takes a mutex. Slots are never freed: the state
+// of a destroyed lock is dropped and its slot keeps the address, for
+// the next lock created there.
+
+#ifndef ETSAN_LOCK_TABLE_H_
+#define ETSAN_LOCK_TABLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#include "metadata_allocator.h"
+
+template <typename State>
+class LockTable {
+
+public:
+
+  static const size_t kFirstSegmentSlots = 1024;
+
+  ~LockTable() { clear(); }
+
+  // Returns the state of the lock at "key", creating it and calling
+  // init on it first if there is none.
+  State & get(const void * key, void (*init)(State &)) {
+    Segment * s = head();
+    for (;;) {
+      // a segment with a successor is sealed: no claims after this
+      Segment * next = s->next.load(std::memory_order_acquire);
+      Slot * slot = s->find(key);
+      if (slot) return *revive(*slot, init);
+      if (next) {
+        s = next;
+        continue;
+      }
+
+      // not found: claim a slot in the last segment unless sealed
+      s->inserting.fetch_add(1);
+      if (!s->sealed.load()) {
+        slot = s->claim(key);
+        s->inserting.fetch_sub(1);
+        if (slot) return *revive(*slot, init);
+      } else {
+        s->inserting.fetch_sub(1);
+      }
+      grow(s);
+    }
+  }
+
+  // Returns the state of the lock at "key", if any
+  State * find(const void * key) const {
+    for (Segment * s = head(); s; s = s->next.load(std::memory_order_acquire)) {
+      Slot * slot = s->find(key);
+      if (slot) {
+        State * state = slot->state.load(std::memory_order_acquire);
+        return state == erased() ? nullptr : state;
+      }
+    }
+    return nullptr;
+  }
+
+  // Drops the state of the lock at "key", calling done on it before
+  // it is freed. Returns false if there is none.
+  template <typename Done>
+  bool erase(const void * key, Done done) {
+    for (Segment * s = head(); s; s = s->next.load(std::memory_order_acquire)) {
+      Slot * slot = s->find(key);
+      if (!slot) continue;
+      State * state = slot->state.load(std::memory_order_acquire);
+      if (state == nullptr || state == erased() ||
+          !slot->state.compare_exchange_strong(state, erased())) {
+        return false;
+      }
+      done(*state);
+      state->~State();
+      MetaAlloc.deallocate(state, sizeof(State));
+      live.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+    return false;
+  }
+
+  // Locks with a state
+  size_t size() const { return live.load(std::memory_order_relaxed); }
+
+  // Bytes of the slots of all segments
+  size_t slotBytes() const {
+    size_t bytes = 0;
+    for (Segment * s = head(); s; s = s->next.load(std::memory_order_acquire)) {
+      bytes += Segment::bytes(s->mask + 1);
+    }
+    return bytes;
+  }
+
+  // Drops all states and slots. NOTE: only when no thread uses the table.
+  void clear() {
+    Segment * s = first.exchange(nullptr);
+    while (s) {
+      Segment * next = s->next.load();
+      for (size_t i = 0; i <= s->mask; i++) {
+        State * state = s->slots[i].state.load();
+        if (state && state != erased()) {
+          state->~State();
+          MetaAlloc.deallocate(state, sizeof(State));
+        }
+      }
+      MetaAlloc.deallocate(s, Segment::bytes(s->mask + 1));
+      s = next;
+    }
+    live.store(0);
+  }
+
+private:
+
+  struct Slot {
+    std::atomic<const void *> key;
+    std::atomic<State *> state; // nullptr while being created
+  };
+
+  struct Segment {
+    size_t mask;                     // slots - 1, slots a power of 2
+    std::atomic<size_t> used{0};     // claimed slots
+    std::atomic<bool> sealed{false}; // no more claims: full
+    std::atomic<int> inserting{0};   // claims in progress
+    std::atomic<Segment *> next{nullptr};
+    Slot slots[1];
+
+    static size_t bytes(size_t n) {
+      return sizeof(Segment) + (n - 1) * sizeof(Slot);
+    }
+
+    static Segment * create(size_t n) {
+      Segment * s = new (MetaAlloc.allocate(bytes(n))) Segment();
+      s->mask = n - 1;
+      for (size_t i = 0; i < n; i++) {
+        new (&s->slots[i]) Slot();
+        s->slots[i].key.store(nullptr, std::memory_order_relaxed);
+        s->slots[i].state.store(nullptr, std::memory_order_relaxed);
+      }
+      return s;
+    }
+
+    static size_t hash(const void * key) {
+      uintptr_t h = (uintptr_t)key;
+      h ^= h >> 17;
+      h *= (uintptr_t)0x9E3779B97F4A7C15ULL;
+      return (size_t)(h ^ (h >> 29));
+    }
+
+    Slot * find(const void * key) {
+      for (size_t i = hash(key), n = 0; n <= mask; i++, n++) {
+        const void * k = slots[i & mask].key.load(std::memory_order_acquire);
+        if (k == key) return &slots[i & mask];
+        if (k == nullptr) return nullptr;
+      }
+      return nullptr;
+    }
+
+    // Claims a free slot for key, or returns the slot another thread
+    // claimed for it meanwhile. Returns nullptr when the segment is
+    // 3/4 full, so that the probe chains stay short.
+    Slot * claim(const void * key) {
+      for (size_t i = hash(key), n = 0; n <= mask; i++, n++) {
+        Slot & slot = slots[i & mask];
+        const void * k = slot.key.load(std::memory_order_acquire);
+        if (k == nullptr) {
+          if (used.load() >= (mask + 1) / 4 * 3) return nullptr;
+          if (slot.key.compare_exchange_strong(k, key)) {
+            used.fetch_add(1);
+            return &slot;
+          }
+        }
+        if (k == key) return &slot;
+      }
+      return nullptr;
+    }
+  };
+
+  mutable std::atomic<Segment *> first{nullptr};
+  std::atomic<size_t> live{0};
+  std::mutex growGuard;
+
+  static State * erased() { return (State *)1; }
+
+  Segment * head() const {
+    Segment * s = first.load(std::memory_order_acquire);
+    if (s) return s;
+    Segment * fresh = Segment::create(kFirstSegmentSlots);
+    if (first.compare_exchange_strong(s, fresh)) {
+      return fresh;
+    }
+    MetaAlloc.deallocate(fresh, Segment::bytes(kFirstSegmentSlots));
+    return s;
+  }
+
+  // Returns the state in slot, creating it if the slot was just
+  // claimed or its lock destroyed. Threads that race to create it
+  // agree on the first state published.
+  State * revive(Slot & slot, void (*init)(State &)) {
+    for (;;) {
+      State * state = slot.state.load(std::memory_order_acquire);
+      if (state != nullptr && state != erased()) return state;
+
+      State * fresh = new (MetaAlloc.allocate(sizeof(State))) State();
+      init(*fresh);
+      if (state == nullptr) {
+        // claimed by this thread, or being created by another one
+        State * expected = nullptr;
+        if (slot.state.compare_exchange_strong(expected, fresh)) {
+          live.fetch_add(1, std::memory_order_relaxed);
+          return fresh;
+        }
+      } else if (slot.state.compare_exchange_strong(state, fresh)) {
+        live.fetch_add(1, std::memory_order_relaxed);
+        return fresh;
+      }
+      fresh->~State();
+      MetaAlloc.deallocate(fresh, sizeof(State));
+    }
+  }
+
+  // Chains a larger segment after the full segment "last"
+  void grow(Segment * last) {
+    std::lock_guard<std::mutex> guard(growGuard);
+    if (last->next.load()) return; // another thread grew it
+    last->sealed.store(true);
+    while (last->inserting.load() != 0) std::this_thread::yield();
+    last->next.store(Segment::create(2 * (last->mask + 1)),
+                     std::memory_order_release);
+  }
+};
+
+#endif // ETSAN_LOCK_TABLE_H_
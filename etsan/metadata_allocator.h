@@ -0,0 +1,183 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Slab allocator for race detection metadata.
+//
+// Variable and lock states and vector clocks are small, numerous and
+// long lived. Allocating them with malloc interleaves them with the
+// program's own heap objects and fragments the heap of small boards.
+// Instead, blocks are carved from mmap'd chunks, one chunk at a time
+// per size class (powers of two from 8 bytes to 2KB), and freed
+// blocks go back to a free list of their class. Larger blocks, e.g.
+// vector clocks of many threads, are mmap'd on their own. Chunks are
+// never unmapped: freed blocks are reused by the same size class.
+
+#ifndef ETSAN_METADATA_ALLOCATOR_H_
+#define ETSAN_METADATA_ALLOCATOR_H_
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+
+#include "spin_lock.h"
+
+class MetadataAllocator {
+
+public:
+
+  static const size_t kMinClassBits = 3;  // 8 bytes
+  static const size_t kMaxClassBits = 11; // 2KB
+  static const size_t kNumClasses = kMaxClassBits - kMinClassBits + 1;
+  static const size_t kChunkSize = 64 * 1024;
+
+  void * allocate(size_t bytes) {
+    if (bytes == 0) bytes = 1;
+    inUse.fetch_add(roundUp(bytes), std::memory_order_relaxed);
+
+    if (bytes > ((size_t)1 << kMaxClassBits)) {
+      return mapLarge(bytes);
+    }
+
+    SizeClass & c = classes[classOf(bytes)];
+    const size_t size = (size_t)1 << (classOf(bytes) + kMinClassBits);
+
+    c.Guard.lock();
+    void * block = c.FreeList;
+    if (block) {
+      c.FreeList = *(void**)block;
+    } else {
+      if (c.Next + size > c.End) refill(c);
+      block = c.Next;
+      c.Next += size;
+    }
+    c.Guard.unlock();
+    return block;
+  }
+
+  void deallocate(void * block, size_t bytes) {
+    if (!block) return;
+    if (bytes == 0) bytes = 1;
+    inUse.fetch_sub(roundUp(bytes), std::memory_order_relaxed);
+
+    if (bytes > ((size_t)1 << kMaxClassBits)) {
+      munmap(block, pageRoundUp(bytes));
+      mapped.fetch_sub(pageRoundUp(bytes), std::memory_order_relaxed);
+      return;
+    }
+
+    SizeClass & c = classes[classOf(bytes)];
+    c.Guard.lock();
+    *(void**)block = c.FreeList;
+    c.FreeList = block;
+    c.Guard.unlock();
+  }
+
+  // Bytes of metadata currently allocated (rounded to size classes)
+  unsigned long bytesInUse() const {
+    return inUse.load(std::memory_order_relaxed);
+  }
+
+  // Bytes mapped from the system for the pools
+  unsigned long bytesMapped() const {
+    return mapped.load(std::memory_order_relaxed);
+  }
+
+private:
+
+  struct SizeClass {
+    SpinLock Guard;
+    void * FreeList = nullptr;
+    char * Next = nullptr; // bump pointer into the current chunk
+    char * End  = nullptr;
+  };
+
+  SizeClass classes[kNumClasses];
+  std::atomic<unsigned long> inUse{0};
+  std::atomic<unsigned long> mapped{0};
+
+  static size_t classOf(size_t bytes) {
+    size_t c = 0;
+    while (((size_t)1 << (c + kMinClassBits)) < bytes) c++;
+    return c;
+  }
+
+  static size_t roundUp(size_t bytes) {
+    if (bytes > ((size_t)1 << kMaxClassBits)) return pageRoundUp(bytes);
+    return (size_t)1 << (classOf(bytes) + kMinClassBits);
+  }
+
+  static size_t pageRoundUp(size_t bytes) {
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (bytes + page - 1) / page * page;
+  }
+
+  void * mapOrDie(size_t size) {
+    void * mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+      printf("EmbedSanitizer: failed to map %lu bytes of metadata\n",
+             (unsigned long)size);
+      abort();
+    }
+    mapped.fetch_add(size, std::memory_order_relaxed);
+    return mem;
+  }
+
+  void * mapLarge(size_t bytes) {
+    return mapOrDie(pageRoundUp(bytes));
+  }
+
+  // Starts a new chunk for size class c; the rest of the
+  // previous chunk is too small for a block and is dropped.
+  // NOTE: Use inside a critical section with the c.Guard lock.
+  void refill(SizeClass & c) {
+    c.Next = (char*)mapOrDie(kChunkSize);
+    c.End = c.Next + kChunkSize;
+  }
+};
+
+MetadataAllocator MetaAlloc; // instance for all metadata of the runtime
+
+// Standard allocator adaptor, so that the containers of the
+// runtime (vector clocks, hash maps) allocate from MetaAlloc.
+template <typename T>
+class MetadataStlAllocator {
+
+public:
+
+  using value_type = T;
+
+  MetadataStlAllocator() = default;
+
+  template <typename U>
+  MetadataStlAllocator(const MetadataStlAllocator<U> &) {}
+
+  T * allocate(size_t n) {
+    return (T*)MetaAlloc.allocate(n * sizeof(T));
+  }
+
+  void deallocate(T * p, size_t n) {
+    MetaAlloc.deallocate(p, n * sizeof(T));
+  }
+
+  template <typename U>
+  bool operator==(const MetadataStlAllocator<U> &) const { return true; }
+
+  template <typename U>
+  bool operator!=(const MetadataStlAllocator<U> &) const { return false; }
+};
+
+#endif // ETSAN_METADATA_ALLOCATOR_H_
@@ -0,0 +1,411 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Direct-mapped shadow memory for variable states.
+//
+// An application address is split into a directory index and a page
+// offset. The directory holds a pointer to a lazily mmap'd page of
+// cells, one cell per granule of 2^GranuleBits application bytes:
+//
+//   32-bit ARM:    | dir (20 - GranuleBits) | offset (12) | granule |
+//   64-bit hosts:  | top (16) | dir (20)    | offset (12) | granule |
+//
+// Finding the cell of an address is two (three on 64-bit hosts) array
+// indexing operations: no hashing and no global lock. Pages are never
+// unmapped while the program runs, so a cell reference stays valid.
+// Pages of released memory are only zero-filled again (see reset()),
+// which requires a zero-filled cell to be a fresh cell, as after mmap.
+//
+// Each page is preceded by a header that records whether the page was
+// looked up recently and whether it is resident. With a memory budget
+// (see evict()), cold pages are zero-filled with the CLOCK policy and
+// lookups of their formerly used cells are counted as re-touches.
+
+#ifndef ETSAN_SHADOW_MEMORY_H_
+#define ETSAN_SHADOW_MEMORY_H_
+
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+
+#include "spin_lock.h"
+#include "metadata_allocator.h"
+
+template <typename Cell, unsigned GranuleBits = 0>
+class ShadowMemory {
+
+public:
+
+  static const uintptr_t kGranule = (uintptr_t)1 << GranuleBits;
+  static const uintptr_t kPageBits = 12;
+#if UINTPTR_MAX > 0xFFFFFFFFu
+  static const uintptr_t kDirBits  = 20;
+#else
+  // the rest of a 32-bit address: 18 bits (a 1MB directory) for words
+  static const uintptr_t kDirBits  = 32 - GranuleBits - kPageBits;
+#endif
+  static const uintptr_t kCellsPerPage = (uintptr_t)1 << kPageBits;
+  static const uintptr_t kPageMask = kCellsPerPage - 1;
+  static const uintptr_t kDirSize  = (uintptr_t)1 << kDirBits;
+
+  // One bit per cell of a page
+  using Bitmap = std::atomic<uint32_t>;
+
+  // Returns the cell of address "addr", creating its page if needed.
+  Cell & get(const void * addr) {
+    uintptr_t a = (uintptr_t)addr >> GranuleBits;
+    std::atomic<Cell*> & slot = pageSlot(a);
+    Cell * page = slot.load(std::memory_order_acquire);
+    if (!page) {
+      page = newPage(slot);
+    }
+    const uintptr_t i = a & kPageMask;
+    PageHeader & h = header(page);
+    if (!h.referenced.load(std::memory_order_relaxed)) touchPage(h);
+    if (h.evicted.load(std::memory_order_relaxed)) noteRetouch(h, i);
+    return page[i];
+  }
+
+  // Returns the cell of address "addr" or nullptr if it was never mapped.
+  Cell * find(const void * addr) {
+    uintptr_t a = (uintptr_t)addr >> GranuleBits;
+    std::atomic<Cell*> * slot = findPageSlot(a);
+    if (!slot) return nullptr;
+    Cell * page = slot->load(std::memory_order_acquire);
+    if (!page) return nullptr;
+    return &page[a & kPageMask];
+  }
+
+  // Calls fn(cell) for the cells of the granules overlapping
+  // [begin, end), creating their pages if needed. Each page is
+  // looked up once, not once per cell as with get().
+  template <typename Fn>
+  void getRange(const void * begin, const void * end, Fn fn) {
+    uintptr_t c = (uintptr_t)begin >> GranuleBits;
+    const uintptr_t last = ((uintptr_t)end + kGranule - 1) >> GranuleBits;
+
+    while (c < last) {
+      const uintptr_t pageEnd = (c | kPageMask) + 1;
+      const uintptr_t stop = pageEnd < last ? pageEnd : last;
+      std::atomic<Cell*> & slot = pageSlot(c);
+      Cell * page = slot.load(std::memory_order_acquire);
+      if (!page) {
+        page = newPage(slot);
+      }
+      PageHeader & h = header(page);
+      if (!h.referenced.load(std::memory_order_relaxed)) touchPage(h);
+      for (; c < stop; c++) {
+        const uintptr_t i = c & kPageMask;
+        if (h.evicted.load(std::memory_order_relaxed)) noteRetouch(h, i);
+        fn(page[i]);
+      }
+    }
+  }
+
+  // Calls fn(cell) for every cell of every mapped page.
+  template <typename Fn>
+  void forEach(Fn fn) {
+    forEachPageSlot([&](std::atomic<Cell*> & slot) {
+      Cell * page = slot.load(std::memory_order_acquire);
+      if (!page) return;
+      for (uintptr_t i = 0; i < kCellsPerPage; i++) fn(page[i]);
+    });
+  }
+
+  // Resets the cells of granules fully inside [begin, end) to fresh
+  // cells, calling fn(cell) on each used page first. Pages fully
+  // inside the range are given back to the system but stay mapped.
+  // A page is reset under evictGuard, so the CLOCK hand is never
+  // evicting it meanwhile, and each cell under its lock.
+  // @return bytes of shadow pages given back.
+  template <typename Fn>
+  unsigned long reset(const void * begin, const void * end, Fn fn) {
+    uintptr_t c = ((uintptr_t)begin + kGranule - 1) >> GranuleBits;
+    const uintptr_t last = (uintptr_t)end >> GranuleBits;
+    const size_t pageBytes = kCellsPerPage * sizeof(Cell);
+    unsigned long released = 0;
+
+    while (c < last) {
+      const uintptr_t pageEnd = (c | kPageMask) + 1;
+      const uintptr_t stop = pageEnd < last ? pageEnd : last;
+      std::atomic<Cell*> * slot = findPageSlot(c);
+      Cell * page = slot ? slot->load(std::memory_order_acquire) : nullptr;
+
+      if (page) {
+        const bool wholePage = (c & kPageMask) == 0 && stop == pageEnd;
+        evictGuard.lock();
+        for (uintptr_t i = c; i < stop; i++) {
+          Cell & cell = page[i & kPageMask];
+          cell.Guard.lock(); // unlocked by the fresh cell or zero-fill
+          fn(cell);
+          cell.~Cell();
+          if (!wholePage) new (&cell) Cell();
+        }
+        if (wholePage) {
+          releasePage(page, nullptr); // released, not evicted
+          released += pageBytes;
+        }
+        evictGuard.unlock();
+      }
+      c = stop;
+    }
+    return released;
+  }
+
+  // Gives back cold pages with the CLOCK policy until "bytes" of
+  // shadow were released or the hand went twice around all pages.
+  // A page is cold if none of its cells was looked up since the
+  // hand passed it last. evictPage(cells, used) must empty the
+  // kCellsPerPage cells, set the bits of their used ones in bitmap
+  // "used" and return true if the page may now be zero-filled.
+  // @return bytes of shadow pages given back.
+  template <typename Fn>
+  unsigned long evict(unsigned long bytes, Fn evictPage) {
+    const size_t pageBytes = kCellsPerPage * sizeof(Cell);
+    unsigned long released = 0;
+
+    evictGuard.lock(); // one hand
+    const unsigned long steps = 2 * numPages.load(std::memory_order_relaxed);
+    for (unsigned long step = 0; step < steps && released < bytes; step++) {
+      if (!hand) hand = pageList.load(std::memory_order_acquire);
+      PageHeader & h = *hand;
+      hand = h.next;
+
+      if (!h.resident.load(std::memory_order_relaxed)) continue;
+      if (h.referenced.exchange(false, std::memory_order_relaxed)) continue;
+
+      auto * used = newBitmap();
+      if (evictPage(cells(h), used)) {
+        releasePage(cells(h), used);
+        released += pageBytes;
+      } else {
+        deleteBitmap(used);
+      }
+    }
+    evictGuard.unlock();
+    return released;
+  }
+
+  // Number of shadow pages mapped so far
+  unsigned long pages() const {
+    return numPages.load(std::memory_order_relaxed);
+  }
+
+  // Bytes of shadow pages mapped and not given back to the system
+  unsigned long residentBytes() const {
+    return residentPages.load(std::memory_order_relaxed)
+           * (kCellsPerPage * sizeof(Cell));
+  }
+
+  // Lookups of cells that were used when their page was evicted
+  unsigned long retouched() const {
+    return numRetouched.load(std::memory_order_relaxed);
+  }
+
+  // Called before a page is mapped or becomes resident again,
+  // e.g. to evict other pages first
+  void (*beforeGrow)() = nullptr;
+
+  // Unmaps all pages. NOTE: only safe when no other thread
+  // is accessing the shadow, e.g. in unit tests.
+  void clear() {
+    forEachPageSlot([&](std::atomic<Cell*> & slot) {
+      Cell * page = slot.exchange(nullptr);
+      if (page) deletePage(page);
+    });
+    numPages = 0;
+    residentPages = 0;
+    numRetouched = 0;
+    pageList = nullptr;
+    hand = nullptr;
+  }
+
+private:
+
+  // One OS page in front of the cells, so that the cells stay
+  // page aligned and can be zero-filled on their own
+  static const uintptr_t kHeaderBytes = 4096;
+  static const uintptr_t kBitmapWords = kCellsPerPage / 32;
+
+  struct PageHeader {
+    std::atomic<bool> referenced{true};   // looked up since the hand passed
+    std::atomic<bool> resident{true};     // not zero-filled since
+    std::atomic<Bitmap*> evicted{nullptr}; // cells used when evicted
+    PageHeader * next = nullptr;          // next page in mapping order
+  };
+
+  std::atomic<unsigned long> numPages{0};
+  std::atomic<unsigned long> residentPages{0};
+  std::atomic<unsigned long> numRetouched{0};
+
+  std::atomic<PageHeader*> pageList{nullptr}; // all pages, newest first
+  PageHeader * hand = nullptr;              // of the CLOCK, under evictGuard
+  SpinLock evictGuard;
+
+  static PageHeader & header(Cell * page) {
+    return *(PageHeader*)((char*)page - kHeaderBytes);
+  }
+
+  static Cell * cells(PageHeader & h) {
+    return (Cell*)((char*)&h + kHeaderBytes);
+  }
+
+  void touchPage(PageHeader & h) {
+    h.referenced.store(true, std::memory_order_relaxed);
+    if (!h.resident.load(std::memory_order_relaxed)) {
+      if (beforeGrow) beforeGrow(); // the hand skips this page
+      if (!h.resident.exchange(true, std::memory_order_relaxed)) residentPages++;
+    }
+  }
+
+  void noteRetouch(PageHeader & h, uintptr_t i) {
+    Bitmap * used = h.evicted.load(std::memory_order_acquire);
+    const uint32_t bit = 1u << (i & 31);
+    if (used && (used[i >> 5].load(std::memory_order_relaxed) & bit)) {
+      if (used[i >> 5].fetch_and(~bit, std::memory_order_relaxed) & bit) {
+        numRetouched++;
+      }
+    }
+  }
+
+  static Bitmap * newBitmap() {
+    auto * bitmap = (Bitmap*)MetaAlloc.allocate(kBitmapWords * sizeof(Bitmap));
+    for (uintptr_t w = 0; w < kBitmapWords; w++) new (&bitmap[w]) Bitmap(0);
+    return bitmap;
+  }
+
+  static void deleteBitmap(Bitmap * bitmap) {
+    if (bitmap) MetaAlloc.deallocate(bitmap, kBitmapWords * sizeof(Bitmap));
+  }
+
+  // Zero-fills the cells of "page", whose cells are already
+  // destroyed or emptied, and gives its memory to the system.
+  // "evicted" marks the cells that were in use, if evicted.
+  void releasePage(Cell * page, Bitmap * evicted) {
+    PageHeader & h = header(page);
+    madvise(page, kCellsPerPage * sizeof(Cell), MADV_DONTNEED); // reads back as zeros
+    deleteBitmap(h.evicted.exchange(evicted, std::memory_order_acq_rel));
+    h.referenced.store(false, std::memory_order_relaxed);
+    if (h.resident.exchange(false, std::memory_order_relaxed)) residentPages--;
+  }
+
+#if UINTPTR_MAX > 0xFFFFFFFFu
+  static const uintptr_t kTopBits = 16;
+  static const uintptr_t kTopSize = (uintptr_t)1 << kTopBits;
+
+  // Lazily mmap'd directories, one per 4GB of the address space
+  std::atomic<std::atomic<Cell*>*> top[kTopSize] = {};
+
+  std::atomic<Cell*> & pageSlot(uintptr_t a) {
+    std::atomic<Cell*>* dir = findDir(a);
+    if (!dir) dir = newDir(a);
+    return dir[(a >> kPageBits) & (kDirSize - 1)];
+  }
+
+  std::atomic<Cell*> * findPageSlot(uintptr_t a) {
+    std::atomic<Cell*>* dir = findDir(a);
+    if (!dir) return nullptr;
+    return &dir[(a >> kPageBits) & (kDirSize - 1)];
+  }
+
+  std::atomic<Cell*> * findDir(uintptr_t a) {
+    uintptr_t t = (a >> (kPageBits + kDirBits)) & (kTopSize - 1);
+    return top[t].load(std::memory_order_acquire);
+  }
+
+  std::atomic<Cell*> * newDir(uintptr_t a) {
+    uintptr_t t = (a >> (kPageBits + kDirBits)) & (kTopSize - 1);
+    // zero-filled by mmap: every page slot starts as nullptr
+    auto * dir = (std::atomic<Cell*>*)mapOrDie(kDirSize * sizeof(std::atomic<Cell*>));
+    std::atomic<Cell*>* expected = nullptr;
+    if (!top[t].compare_exchange_strong(expected, dir)) {
+      munmap(dir, kDirSize * sizeof(std::atomic<Cell*>)); // lost the race
+      return expected;
+    }
+    return dir;
+  }
+
+  template <typename Fn>
+  void forEachPageSlot(Fn fn) {
+    for (uintptr_t t = 0; t < kTopSize; t++) {
+      std::atomic<Cell*>* dir = top[t].load(std::memory_order_acquire);
+      if (!dir) continue;
+      for (uintptr_t d = 0; d < kDirSize; d++) fn(dir[d]);
+    }
+  }
+#else
+  // A single directory covers the whole 32-bit address space
+  std::atomic<Cell*> dir[kDirSize] = {};
+
+  std::atomic<Cell*> & pageSlot(uintptr_t a) {
+    return dir[a >> kPageBits];
+  }
+
+  std::atomic<Cell*> * findPageSlot(uintptr_t a) {
+    return &dir[a >> kPageBits];
+  }
+
+  template <typename Fn>
+  void forEachPageSlot(Fn fn) {
+    for (uintptr_t d = 0; d < kDirSize; d++) fn(dir[d]);
+  }
+#endif
+
+  static void * mapOrDie(size_t size) {
+    void * mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+      printf("EmbedSanitizer: failed to map %lu bytes of shadow memory\n",
+             (unsigned long)size);
+      abort();
+    }
+    return mem;
+  }
+
+  // Maps and publishes a page for "slot". If another thread
+  // published one first, ours is dropped and theirs is used.
+  Cell * newPage(std::atomic<Cell*> & slot) {
+    if (beforeGrow) beforeGrow();
+    char * mem = (char*)mapOrDie(kHeaderBytes + kCellsPerPage * sizeof(Cell));
+    PageHeader * h = new (mem) PageHeader();
+    Cell * page = cells(*h);
+    for (uintptr_t i = 0; i < kCellsPerPage; i++) new (&page[i]) Cell();
+
+    Cell * expected = nullptr;
+    if (!slot.compare_exchange_strong(expected, page,
+                                      std::memory_order_acq_rel)) {
+      deletePage(page);
+      return expected;
+    }
+
+    // publish for the CLOCK hand
+    h->next = pageList.load(std::memory_order_relaxed);
+    while (!pageList.compare_exchange_weak(h->next, h,
+                                         std::memory_order_release)) {}
+    numPages++;
+    residentPages++;
+    return page;
+  }
+
+  static void deletePage(Cell * page) {
+    for (uintptr_t i = 0; i < kCellsPerPage; i++) page[i].~Cell();
+    PageHeader & h = header(page);
+    deleteBitmap(h.evicted.load());
+    h.~PageHeader();
+    munmap(&h, kHeaderBytes + kCellsPerPage * sizeof(Cell));
+  }
+};
+
+#endif // ETSAN_SHADOW_MEMORY_H_
@@ -0,0 +1,39 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+#ifndef ETSAN_SPIN_LOCK_H_
+#define ETSAN_SPIN_LOCK_H_
+
+#include <atomic>
+#include <thread>
+
+// A small test-and-test-and-set lock for guarding a single
+// metadata object. Critical sections of FastTrack are a few
+// instructions long, so spinning is cheaper than a mutex.
+class SpinLock {
+  std::atomic<bool> locked{false};
+
+public:
+  void lock() {
+    while (locked.exchange(true, std::memory_order_acquire)) {
+      while (locked.load(std::memory_order_relaxed)) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  void unlock() {
+    locked.store(false, std::memory_order_release);
+  }
+};
+
+#endif // ETSAN_SPIN_LOCK_H_
@@ -0,0 +1,284 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Tree clocks (Mathur et al., "A Tree Clock Data Structure for Causal
+// Orderings in Concurrent Executions", ASPLOS'22).
+//
+// A tree clock keeps the entries of a vector clock plus a tree over
+// the threads: the root is the owner of the clock (a thread, or the
+// last releaser of a lock) and a node v hangs below node u if the
+// clock learned the entry of v through u. Each node also keeps the
+// clock of its parent when it was attached (aclk); children are kept
+// in decreasing aclk order. Whoever knows u at aclk or later already
+// knows v, so joins and copies stop at such children and only visit
+// the entries that actually change, instead of all threads.
+//
+// The pruning relies on every publication of a clock (release, fork,
+// join) being followed by an increment of its owner, as in ft_release,
+// ft_fork and ft_join. Entries written out of tree order through []
+// (other than the owner's entry and zero clocks) make the clock "flat":
+// it then joins and copies like a vector clock.
+
+#ifndef ETSAN_TREE_CLOCK_H_
+#define ETSAN_TREE_CLOCK_H_
+
+#include <stdint.h>
+#include <initializer_list>
+#include <stdexcept>
+#include <vector>
+
+#include "metadata_allocator.h"
+#include "vector_clock.h"
+
+template <typename E, E ClockMask>
+class TreeClock {
+
+  using U = typename PaddedVectorClock<E>::U;
+
+  static const uint32_t kNone = UINT32_MAX;
+
+  struct Node {
+    E aclk = 0;               // clock of the parent when attached
+    uint32_t parent = kNone;
+    uint32_t child = kNone;   // first child: the latest attached
+    uint32_t next = kNone;    // next sibling, attached earlier
+    uint32_t prev = kNone;
+  };
+
+  using Nodes = std::vector<Node, MetadataStlAllocator<Node>>;
+  using Stack = std::vector<uint32_t, MetadataStlAllocator<uint32_t>>;
+
+public:
+
+  // Reference to an entry. Writes keep track of the owner (root).
+  class Entry {
+  public:
+    operator E() const { return tc.clk[i]; }
+    Entry & operator=(E epoch) {
+      tc.set(i, epoch);
+      return *this;
+    }
+    Entry & operator=(const Entry & other) { return *this = (E)other; }
+  private:
+    friend class TreeClock;
+    Entry(TreeClock & tc, size_t i) : tc(tc), i(i) {}
+    TreeClock & tc;
+    size_t i;
+  };
+
+  TreeClock() {}
+
+  TreeClock(std::initializer_list<E> epochs) { *this = epochs; }
+
+  TreeClock & operator=(std::initializer_list<E> epochs) {
+    clk.clear();
+    nodes.clear();
+    root = kNone;
+    flat = false;
+    for (E epoch : epochs) push_back(epoch);
+    return *this;
+  }
+
+  size_t size() const { return clk.size(); }
+  size_t capacity() const { return clk.capacity(); }
+  bool empty() const { return clk.empty(); }
+
+  E operator[](size_t i) const { return clk[i]; }
+  Entry operator[](size_t i) { return Entry(*this, i); }
+
+  E at(size_t i) const { return clk.at(i); }
+  Entry at(size_t i) {
+    if (i >= size()) throw std::out_of_range("TreeClock::at");
+    return Entry(*this, i);
+  }
+
+  void resize(size_t size) {
+    if (size < clk.size()) flat = true; // nodes may refer to dropped ones
+    clk.resize(size);
+    nodes.resize(size);
+  }
+
+  void push_back(E epoch) {
+    clk.push_back(0);
+    nodes.push_back(Node());
+    set(clk.size() - 1, epoch);
+  }
+
+  // this := this U other, visiting only the entries that change.
+  // NOTE: size() >= other.size() must hold.
+  void join(const TreeClock & other) {
+    if (flat || root == kNone) {
+      clk.join(other.clk);
+      flat = true;
+      return;
+    }
+    if (other.flat || other.root == kNone) {
+      attachChanged(other);
+      return;
+    }
+
+    const uint32_t z = other.root;
+    if ((U)other.clk[z] <= (U)clk[z]) return; // knows it all
+    if (z == root) {
+      attachChanged(other); // not published by this owner: no pruning
+      return;
+    }
+
+    Stack & S = scratch();
+    collect(other, z, root, kNone, S);
+
+    for (uint32_t u : S) detach(u);
+    for (size_t s = S.size(); s-- > 0; ) {
+      const uint32_t u = S[s];
+      clk[u] = other.clk[u];
+      if (u != z) attach(u, other.nodes[u].parent, other.nodes[u].aclk);
+    }
+    attach(z, root, clk[root]);
+  }
+
+  // other.join(*this), the interface of a lock clock
+  void joinInto(TreeClock & t) const { t.join(*this); }
+
+  // this[i] = epoch, for a releaser i that released this clock and
+  // learned nothing since: the root's entry is all that changed.
+  void advance(size_t i, E epoch) { set(i, epoch); }
+
+  // this := c, when c releases the lock of this clock. If c already
+  // knows this clock (c acquired the lock since its last release),
+  // only the entries that change are visited: a monotone copy.
+  void copyFrom(const TreeClock & c, size_t releaser) {
+    (void)releaser; // the root of c
+    if (size() < c.size()) resize(c.size());
+
+    const bool monotone = !flat && !c.flat && root != kNone &&
+      c.root != kNone && size() == c.size() &&
+      (U)c.clk[root] >= (U)clk[root];
+    if (!monotone) {
+      deepCopy(c);
+      return;
+    }
+
+    const uint32_t z = c.root, oldRoot = root;
+    if (z == oldRoot && c.clk[z] == clk[z]) return; // nothing new
+
+    Stack & S = scratch();
+    collect(c, z, kNone, oldRoot, S);
+
+    for (uint32_t u : S) detach(u);
+    for (size_t s = S.size(); s-- > 0; ) {
+      const uint32_t u = S[s];
+      clk[u] = c.clk[u];
+      if (u != z) attach(u, c.nodes[u].parent, c.nodes[u].aclk);
+    }
+    root = z;
+
+    // the old root must hang below the new one by now
+    if (oldRoot != z && nodes[oldRoot].parent == kNone) deepCopy(c);
+  }
+
+private:
+
+  PaddedVectorClock<E> clk; // the entries, as in a vector clock
+  Nodes nodes;
+  uint32_t root = kNone;    // owner of the clock
+  bool flat = false;        // tree no longer describes the entries
+
+  static Stack & scratch() {
+    static thread_local Stack S;
+    S.clear();
+    return S;
+  }
+
+  void set(size_t i, E epoch) {
+    if ((epoch & ClockMask) != 0 && i != root) {
+      if (root == kNone) root = i;
+      else flat = true;
+    }
+    clk[i] = epoch;
+  }
+
+  void detach(uint32_t u) {
+    Node & n = nodes[u];
+    if (n.parent == kNone) return;
+    if (n.prev != kNone) nodes[n.prev].next = n.next;
+    else nodes[n.parent].child = n.next;
+    if (n.next != kNone) nodes[n.next].prev = n.prev;
+    n.parent = n.next = n.prev = kNone;
+  }
+
+  // Makes u the latest child of parent
+  void attach(uint32_t u, uint32_t parent, E aclk) {
+    Node & n = nodes[u];
+    n.aclk = aclk;
+    n.parent = parent;
+    n.prev = kNone;
+    n.next = nodes[parent].child;
+    if (n.next != kNone) nodes[n.next].prev = u;
+    nodes[parent].child = u;
+  }
+
+  // Pushes the nodes of "other" below z whose entries this clock
+  // lacks, children first. A child known to this clock ends the
+  // visit of its siblings once this clock knows the parent at the
+  // child's aclk: the later siblings were attached even earlier.
+  // "skip" counts as known, "keep" is pushed even if known, so that
+  // it can be moved.
+  void collect(const TreeClock & other, uint32_t z, uint32_t skip,
+               uint32_t keep, Stack & S) const {
+    struct Frame {
+      uint32_t u;
+      uint32_t next; // child of u to visit next
+    };
+    static thread_local std::vector<Frame, MetadataStlAllocator<Frame>> frames;
+    frames.clear();
+    frames.push_back({ z, other.nodes[z].child });
+
+    while (!frames.empty()) {
+      Frame & f = frames.back();
+      const uint32_t v = f.next;
+      if (v == kNone) {
+        S.push_back(f.u);
+        frames.pop_back();
+        continue;
+      }
+      f.next = other.nodes[v].next;
+
+      if (v != skip && (U)clk[v] < (U)other.clk[v]) {
+        frames.push_back({ v, other.nodes[v].child });
+      } else if (v == keep) {
+        S.push_back(v);
+      } else if ((U)other.nodes[v].aclk <= (U)clk[f.u]) {
+        f.next = kNone;
+      }
+    }
+  }
+
+  // Joins a flat clock: changed entries hang below the root, which
+  // knows them from now on.
+  void attachChanged(const TreeClock & other) {
+    for (uint32_t i = 0; i < other.size(); i++) {
+      if (i == root || (U)other.clk[i] <= (U)clk[i]) continue;
+      clk[i] = other.clk[i];
+      detach(i);
+      attach(i, root, clk[root]);
+    }
+  }
+
+  void deepCopy(const TreeClock & c) {
+    clk = c.clk;
+    nodes = c.nodes;
+    root = c.root;
+    flat = c.flat;
+  }
+};
+
+#endif // ETSAN_TREE_CLOCK_H_
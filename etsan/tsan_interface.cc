@@ -11,6 +11,8 @@
 //            Email: hmatar@ku.edu.tr
 //===----------------------------------------------------------------------===//
 
+#include <malloc.h>
+
 #include "tsan_interface.h"
 #include "fasttrack.h"
 #include "race_report.h"
@@ -31,309 +33,360 @@ void __tsan_main_func_exit() {
   etsan::printRaces();
 }
 
-// 1. Callbacks for memory accesses
-void __tsan_read1(void* addr,
-       int lineNo,
-       void * objName,
-       void* fileName) {
+// Checks a read of "size" bytes by the current thread and reports
+// a race at "site" if found. Reads already done in the current epoch
+// return before any lock.
+static inline void checkRead(const void *addr,
+       std::size_t size,
+       const __tsan_site *site) {
   if (isConcurrent) {
-    bool isRace = ft_read( getVarState(addr, false), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnRead( lineNo, objName, fileName );
+    if ( ft_read(addr, size, getThreadState()) ) {
+      etsan::reportRaceOnRead( site->line, (void*)site->object,
+                               (void*)site->file );
     }
   }
-  //  MemoryRead(cur_thread(), CALLERPC, (uptr)addr, kSizeLog1);
 }
 
-void __tsan_read2(
-       void* addr,
-       int lineNo,
-       void * objName,
-       void* fileName) {
+// Checks a write of "size" bytes by the current thread and reports
+// a race at "site" if found. Writes already done in the current epoch
+// return before any lock.
+static inline void checkWrite(const void *addr,
+       std::size_t size,
+       const __tsan_site *site) {
   if (isConcurrent) {
-    bool isRace = ft_read( getVarState(addr, false), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnRead( lineNo, objName, fileName );
+    if ( ft_write(addr, size, getThreadState()) ) {
+      etsan::reportRaceOnWrite( site->line, (void*)site->object,
+                                (void*)site->file );
     }
   }
 }
 
-void __tsan_read4(
-       void* addr,
-       int lineNo,
-       void * objName,
-       void* fileName) {
-  if (isConcurrent) {
-    bool isRace = ft_read( getVarState(addr, false), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnRead( lineNo, objName, fileName );
-    }
-  }
+// 1. Callbacks for memory accesses
+void __tsan_read1(void* addr, const __tsan_site *site) {
+  checkRead(addr, 1, site);
+  //  MemoryRead(cur_thread(), CALLERPC, (uptr)addr, kSizeLog1);
 }
 
-void __tsan_read8(
-       void* addr,
-       int lineNo,
-       void * objName,
-       void* fileName) {
-  if (isConcurrent) {
-    bool isRace = ft_read( getVarState(addr, false), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnRead( lineNo, objName, fileName );
-    }
-  }
+void __tsan_read2(void* addr, const __tsan_site *site) {
+  checkRead(addr, 2, site);
 }
 
-void __tsan_read16(
-       void* addr,
-       int lineNo,
-       void * objName,
-       void* fileName) {
-  if (isConcurrent) {
-    bool isRace = ft_read( getVarState(addr, false), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnRead( lineNo, objName, fileName );
-    }
-  }
+void __tsan_read4(void* addr, const __tsan_site *site) {
+  checkRead(addr, 4, site);
 }
 
-void __tsan_write1(
-       void* addr,
-       int lineNo,
-       void* objName,
-       void* fileName) {
-  if (isConcurrent) {
-    bool isRace = ft_write( getVarState(addr, true), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnWrite( lineNo, objName, fileName );
-    }
-  }
+void __tsan_read8(void* addr, const __tsan_site *site) {
+  checkRead(addr, 8, site);
 }
 
-void __tsan_write2(void * addr,
-       int lineNo,
-       void * objName,
-       void* fileName) {
-  if (isConcurrent) {
-    bool isRace = ft_write( getVarState(addr, true), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnWrite( lineNo, objName, fileName );
-    }
-  }
+void __tsan_read16(void* addr, const __tsan_site *site) {
+  checkRead(addr, 16, site);
+}
+
+void __tsan_write1(void* addr, const __tsan_site *site) {
+  checkWrite(addr, 1, site);
+}
+
+void __tsan_write2(void* addr, const __tsan_site *site) {
+  checkWrite(addr, 2, site);
 }
 
-void __tsan_write4(
-       void* addr,
-       int lineNo,
-       void * objName,
-       void* fileName) {
+void __tsan_write4(void* addr, const __tsan_site *site) {
 //  printf("Memory write at line: %p\n", CALLERPC);
-  if (isConcurrent) {
-    bool isRace = ft_write( getVarState(addr, true), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnWrite( lineNo, objName, fileName );
-    }
-  }
+  checkWrite(addr, 4, site);
 }
 
-void __tsan_write8(
-       void* addr,
-       int lineNo,
-       void * objName,
-       void* fileName) {
+void __tsan_write8(void* addr, const __tsan_site *site) {
+  checkWrite(addr, 8, site);
+}
+
+void __tsan_write16(void* addr, const __tsan_site *site) {
+  checkWrite(addr, 16, site);
+}
+
+
+void __tsan_read_range(void* addr, unsigned long size,
+                       const __tsan_site *site) {
   if (isConcurrent) {
-    bool isRace = ft_write( getVarState(addr, true), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnWrite( lineNo, objName, fileName );
+    if ( ft_access_range(addr, size, getThreadState(), false) ) {
+      etsan::reportRaceOnRead( site->line, (void*)site->object,
+                               (void*)site->file );
     }
   }
 }
 
-void __tsan_write16(
-       void* addr,
-       int lineNo,
-       void * objName,
-       void* fileName) {
+void __tsan_write_range(void* addr, unsigned long size,
+                        const __tsan_site *site) {
   if (isConcurrent) {
-    bool isRace = ft_write( getVarState(addr, true), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnWrite( lineNo, objName, fileName );
+    if ( ft_access_range(addr, size, getThreadState(), true) ) {
+      etsan::reportRaceOnWrite( site->line, (void*)site->object,
+                                (void*)site->file );
     }
   }
 }
 
 
 // 2. Callbacks for unaligned memory accesses
-void __tsan_unaligned_read2(
-       const void *addr,
-       int lineNo,
-       void * objName,
-       void* fileName) {
-  if (isConcurrent) {
-    bool isRace = ft_read( getVarState(addr, false), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnRead( lineNo, objName, fileName );
-    }
-  }
+void __tsan_unaligned_read2(const void* addr, const __tsan_site *site) {
+  checkRead(addr, 2, site);
 }
 
 
-void __tsan_unaligned_read4(
-       const void *addr,
-       int lineNo,
-       void * objName,
-       void* fileName) {
-  if (isConcurrent) {
-    bool isRace = ft_read( getVarState(addr, false), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnRead( lineNo, objName, fileName );
-    }
-  }
+void __tsan_unaligned_read4(const void* addr, const __tsan_site *site) {
+  checkRead(addr, 4, site);
 }
 
-void __tsan_unaligned_read8(
-       const void *addr,
-       int lineNo,
-       void * objName,
-       void* fileName) {
-  if (isConcurrent) {
-    bool isRace = ft_read( getVarState(addr, false), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnRead( lineNo, objName, fileName );
-    }
-  }
+void __tsan_unaligned_read8(const void* addr, const __tsan_site *site) {
+  checkRead(addr, 8, site);
 }
 
-void __tsan_unaligned_read16(
-       const void *addr,
-       int lineNo,
-       void * objName,
-       void* fileName) {
-  if (isConcurrent) {
-    bool isRace = ft_read( getVarState(addr, false), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnRead( lineNo, objName, fileName );
-    }
-  }
+void __tsan_unaligned_read16(const void* addr, const __tsan_site *site) {
+  checkRead(addr, 16, site);
 }
 
-void __tsan_unaligned_write2(
-       void* addr,
-       int lineNo,
-       void * objName,
-       void* fileName) {
-  if (isConcurrent) {
-    bool isRace = ft_write( getVarState(addr, true), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnWrite( lineNo, objName, fileName );
-    }
-  }
+void __tsan_unaligned_write2(void* addr, const __tsan_site *site) {
+  checkWrite(addr, 2, site);
 }
 
-void __tsan_unaligned_write4(
-       void* addr,
-       int lineNo,
-       void * objName,
-       void* fileName) {
-  if (isConcurrent) {
-    bool isRace = ft_write( getVarState(addr, true), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnWrite( lineNo, objName, fileName );
-    }
-  }
+void __tsan_unaligned_write4(void* addr, const __tsan_site *site) {
+  checkWrite(addr, 4, site);
 }
 
-void __tsan_unaligned_write8(
-       void* addr,
-       int lineNo,
-       void * objName,
-       void* fileName) {
-  if (isConcurrent) {
-    bool isRace = ft_write( getVarState(addr, true), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnWrite( lineNo, objName, fileName );
-    }
-  }
+void __tsan_unaligned_write8(void* addr, const __tsan_site *site) {
+  checkWrite(addr, 8, site);
 }
 
-void __tsan_unaligned_write16(
-       void* addr,
-       int lineNo,
-       void * objName,
-       void* fileName) {
-  if (isConcurrent) {
-    bool isRace = ft_write( getVarState(addr, true), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnWrite( lineNo, objName, fileName );
-    }
-  }
+void __tsan_unaligned_write16(void* addr, const __tsan_site *site) {
+  checkWrite(addr, 16, site);
 }
 
 // 3. Callbacks for virtual pointer accesses
-void __tsan_vptr_read(void **vptr_p,
-       int lineNo,
-       void * objName,
-       void* fileName) {
-  if (isConcurrent) {
-    bool isRace = ft_write( getVarState(vptr_p, false), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnWrite( lineNo, objName, fileName );
-    }
-  }
+void __tsan_vptr_read(void **vptr_p, const __tsan_site *site) {
+  checkRead(vptr_p, sizeof(void*), site);
 }
 
 void __tsan_vptr_update(void **vptr_p, void *new_val,
-       int lineNo,
-       void * objName,
-       void* fileName) {
-  if (isConcurrent) {
-    bool isRace = ft_write( getVarState(vptr_p, true), getThreadState() );
-    if ( isRace ) {
-      etsan::reportRaceOnWrite( lineNo, objName, fileName );
-    }
-  }
+                        const __tsan_site *site) {
+  checkWrite(vptr_p, sizeof(void*), site);
 }
 
 
 // 4. Callbacks for synchronization events
 void __tsan_thread_create(void * childIdAddr) {
   unsigned int child_id = *((unsigned int*)childIdAddr);
-  unsigned int parent_id = (unsigned int)pthread_self();
-  ft_fork( getState(parent_id), getState(child_id) );
+  ft_fork( getThreadState(), getState(child_id) );
 }
 
 void __tsan_thread_join(void * childIdAddr) {
 
   unsigned int child_id = reinterpret_cast<unsigned int>(childIdAddr);
-  unsigned int parent_id = (unsigned int)pthread_self();
-  ft_join( getState(parent_id), getState(child_id) );
+  ft_join( getThreadState(), child_id );
 }
 
 void __tsan_thread_lock(void * lock) {
   ft_acquire( getThreadState(), getLockState(lock) );
 }
 
+// "result" is the return value of the try or timed lock function:
+// 0 if it took the lock
+void __tsan_thread_trylock(void * lock, int result) {
+  if (result == 0) __tsan_thread_lock(lock);
+}
+
 void __tsan_thread_unlock(void * lock) {
   ft_release( getThreadState(), getLockState(lock) );
 }
 
-__tsan_atomic8 __tsan_atomic8_load(const volatile __tsan_atomic8 *a,
-                                   __tsan_memory_order mo) {
- ft_atomic_load();
+void __tsan_thread_lock_destroy(void * lock) {
+  reclaimLockState(lock);
+}
+
+void __tsan_rwlock_rdlock(void * lock) {
+  ft_acquire( getThreadState(), getRWLockState(lock), false );
+}
+
+void __tsan_rwlock_wrlock(void * lock) {
+  ft_acquire( getThreadState(), getRWLockState(lock), true );
+}
+
+// "result" is the return value of the try function: 0 if it took the lock
+void __tsan_rwlock_tryrdlock(void * lock, int result) {
+  if (result == 0) __tsan_rwlock_rdlock(lock);
+}
+
+void __tsan_rwlock_trywrlock(void * lock, int result) {
+  if (result == 0) __tsan_rwlock_wrlock(lock);
+}
+
+void __tsan_rwlock_unlock(void * lock) {
+  ft_release( getThreadState(), getRWLockState(lock) );
+}
+
+void __tsan_rwlock_destroy(void * lock) {
+  reclaimRWLockState(lock);
 }
-__tsan_atomic16 __tsan_atomic16_load(const volatile __tsan_atomic16 *a,
-                                     __tsan_memory_order mo) {
- ft_atomic_load();
+
+// pthread_cond_wait() releases "mutex" in __tsan_cond_wait_enter() and
+// takes it again in __tsan_cond_wait(), after a signal if result is 0
+void __tsan_cond_wait_enter(void * cond, void * mutex) {
+  ft_release( getThreadState(), getLockState(mutex) );
+}
+
+void __tsan_cond_wait(void * cond, void * mutex, int result) {
+  ThreadState & t = getThreadState();
+  if (result == 0) ft_wait( t, getCondState(cond) );
+  ft_acquire( t, getLockState(mutex) );
+}
+
+void __tsan_cond_signal(void * cond) {
+  ft_signal( getThreadState(), getCondState(cond) );
+}
+
+void __tsan_cond_destroy(void * cond) {
+  reclaimCondState(cond);
 }
 
-__tsan_atomic32 __tsan_atomic32_load(const volatile __tsan_atomic32 *a,
-                                     __tsan_memory_order mo) {
-  ft_atomic_load();
+void __tsan_barrier_init(void * barrier, unsigned count) {
+  initBarrierState(barrier, count);
+}
+
+void __tsan_barrier_wait_enter(void * barrier) {
+  ft_arrive( getThreadState(), getBarrierState(barrier) );
+}
+
+void __tsan_barrier_wait(void * barrier) {
+  ft_depart( getThreadState(), getBarrierState(barrier) );
+}
+
+void __tsan_barrier_destroy(void * barrier) {
+  reclaimBarrierState(barrier);
+}
+
+// 5. Callbacks for released memory
+// Only for blocks of malloc: other allocators have no usable size
+void __tsan_free(void * addr) {
+  if (addr) {
+    reclaimVarStates(addr, malloc_usable_size(addr));
+  }
+}
+
+void __tsan_free_sized(void * addr, unsigned long size) {
+  if (addr) {
+    reclaimVarStates(addr, size);
+  }
+}
+
+void __tsan_munmap(void * addr, unsigned long size) {
+  reclaimVarStates(addr, size);
+}
+
+// 6. Callbacks for atomic operations. The operation itself is
+// sequentially consistent, its clock work follows its memory order.
+static int atomicSync(__tsan_memory_order mo) {
+  switch (mo) {
+    case __tsan_memory_order_relaxed: return kAtomicRelaxed;
+    case __tsan_memory_order_consume:
+    case __tsan_memory_order_acquire: return kAtomicAcquire;
+    case __tsan_memory_order_release: return kAtomicRelease;
+    default:                          return kAtomicAcquire | kAtomicRelease;
+  }
+}
+
+// Performs op, a load, store or read-modify-write of "a" (the
+// kAtomicRead and kAtomicWrite bits of "access") with synchronization
+// "sync", and returns its result
+template <typename T, typename Op>
+static T atomicOp(const volatile T * a, int sync, int access, Op op) {
+  ThreadState & t = getThreadState();
+  if (sync == kAtomicRelaxed && !ft_fenced(t, (Address)a, access)) {
+    return op();
+  }
+  const bool rmw = access == (kAtomicRead | kAtomicWrite);
+  T v;
+  ft_atomic(t, getAtomicState((Address)a), rmw, [&]() {
+    v = op();
+    return sync | access;
+  });
+  return v;
+}
+
+template <typename T>
+static T atomicCAS(volatile T * a, T c, T v, __tsan_memory_order mo,
+                   __tsan_memory_order fmo) {
+  auto cas = [=]() {
+    T old = c;
+    __atomic_compare_exchange_n(a, &old, v, false, __ATOMIC_SEQ_CST,
+                                __ATOMIC_SEQ_CST);
+    return old;
+  };
+  const int sync = atomicSync(mo);
+  const int failSync = atomicSync(fmo) & kAtomicAcquire;
+  ThreadState & t = getThreadState();
+  if (sync == kAtomicRelaxed && failSync == kAtomicRelaxed &&
+      !ft_fenced(t, (Address)a, kAtomicRead | kAtomicWrite)) {
+    return cas();
+  }
+  T old;
+  ft_atomic(t, getAtomicState((Address)a), true, [&]() {
+    old = cas();
+    return old == c ? sync | kAtomicRead | kAtomicWrite
+                    : failSync | kAtomicRead;
+  });
+  return old;
+}
+
+#define ETSAN_ATOMIC_RMW(T, bits, name, builtin)                            \
+  T __tsan_atomic##bits##_##name(volatile T *a, T v,                        \
+                                 __tsan_memory_order mo) {                  \
+    return atomicOp(a, atomicSync(mo), kAtomicRead | kAtomicWrite, [=]() {  \
+      return builtin(a, v, __ATOMIC_SEQ_CST);                               \
+    });                                                                     \
+  }
+
+#define ETSAN_ATOMIC(T, bits)                                               \
+  T __tsan_atomic##bits##_load(const volatile T *a,                         \
+                               __tsan_memory_order mo) {                    \
+    return atomicOp(a, atomicSync(mo) & kAtomicAcquire, kAtomicRead,        \
+                    [=]() {                                                 \
+      return __atomic_load_n(a, __ATOMIC_SEQ_CST);                          \
+    });                                                                     \
+  }                                                                         \
+  void __tsan_atomic##bits##_store(volatile T *a, T v,                      \
+                                   __tsan_memory_order mo) {                \
+    atomicOp(a, atomicSync(mo) & kAtomicRelease, kAtomicWrite, [=]() {      \
+      __atomic_store_n(a, v, __ATOMIC_SEQ_CST);                             \
+      return v;                                                             \
+    });                                                                     \
+  }                                                                         \
+  ETSAN_ATOMIC_RMW(T, bits, exchange, __atomic_exchange_n)                  \
+  ETSAN_ATOMIC_RMW(T, bits, fetch_add, __atomic_fetch_add)                  \
+  ETSAN_ATOMIC_RMW(T, bits, fetch_sub, __atomic_fetch_sub)                  \
+  ETSAN_ATOMIC_RMW(T, bits, fetch_and, __atomic_fetch_and)                  \
+  ETSAN_ATOMIC_RMW(T, bits, fetch_or, __atomic_fetch_or)                    \
+  ETSAN_ATOMIC_RMW(T, bits, fetch_xor, __atomic_fetch_xor)                  \
+  ETSAN_ATOMIC_RMW(T, bits, fetch_nand, __atomic_fetch_nand)                \
+  T __tsan_atomic##bits##_compare_exchange_val(volatile T *a, T c, T v,     \
+      __tsan_memory_order mo, __tsan_memory_order fmo) {                    \
+    return atomicCAS(a, c, v, mo, fmo);                                     \
+  }
+
+ETSAN_ATOMIC(__tsan_atomic8, 8)
+ETSAN_ATOMIC(__tsan_atomic16, 16)
+ETSAN_ATOMIC(__tsan_atomic32, 32)
+ETSAN_ATOMIC(__tsan_atomic64, 64)
+
+#undef ETSAN_ATOMIC
+#undef ETSAN_ATOMIC_RMW
+
+// A fence orders the relaxed atomics of its thread (see ft_fence)
+void __tsan_atomic_thread_fence(__tsan_memory_order mo) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  ft_fence(getThreadState(), atomicSync(mo));
 }
 
-a8 __tsan_atomic32_fetch_add(volatile a8 *a, a8 v,
-                             __tsan_memory_order mo) {
-  printf("EmbedSanitizer: atomic_fetch_add not implemented\n");
+// Only orders a thread with its own signal handlers: nothing to track
+void __tsan_atomic_signal_fence(__tsan_memory_order mo) {
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
 }
 
 void __tsan_func_entry(void *funcName) {
@@ -28,25 +28,43 @@ void __tsan_init();
 // Useful for printing the collected races.
 void __tsan_main_func_exit();
 
-void __tsan_read1(void *addr, int lineNo, void* objName, void * fileName);
+// Descriptor of an instrumented access (a site), emitted by the pass
+// into the etsan_sites section. Accesses pass its address as the site
+// ID; the runtime reads it only to report a race.
+typedef struct {
+  unsigned int line;
+  const char * file;
+  const char * object;   // name of the variable accessed
+  const char * function;
+} __tsan_site;
 
-void __tsan_read2(void *addr, int lineNo, void* objName, void * fileName);
+void __tsan_read1(void *addr, const __tsan_site *site);
 
-void __tsan_read4(void *addr, int lineNo, void* objName, void * fileName);
+void __tsan_read2(void *addr, const __tsan_site *site);
 
-void __tsan_read8(void *addr, int lineNo, void* objName, void * fileName);
+void __tsan_read4(void *addr, const __tsan_site *site);
 
-void __tsan_read16(void *addr, int lineNo, void* objName, void * fileName);
+void __tsan_read8(void *addr, const __tsan_site *site);
 
-void __tsan_write1(void *addr, int lineNo, void* objName, void * fileName);
+void __tsan_read16(void *addr, const __tsan_site *site);
 
-void __tsan_write2(void *addr, int lineNo, void* objName, void * fileName);
+void __tsan_write1(void *addr, const __tsan_site *site);
 
-void __tsan_write4(void *addr, int lineNo, void* objName, void * fileName);
+void __tsan_write2(void *addr, const __tsan_site *site);
 
-void __tsan_write8(void *addr, int lineNo, void* objName, void * fileName);
+void __tsan_write4(void *addr, const __tsan_site *site);
 
-void __tsan_write16(void *addr, int lineNo, void* objName, void * fileName);
+void __tsan_write8(void *addr, const __tsan_site *site);
+
+void __tsan_write16(void *addr, const __tsan_site *site);
+
+// Accesses of a whole loop to "size" bytes at "addr", checked once
+// before the loop by the pass in place of one check per iteration
+void __tsan_read_range(void *addr, unsigned long size,
+                       const __tsan_site *site);
+
+void __tsan_write_range(void *addr, unsigned long size,
+                        const __tsan_site *site);
 
 void __tsan_func_entry(void *call_pc);
 void __tsan_func_exit(void *call_pc);
@@ -57,22 +75,58 @@ void __tsan_thread_join(void * child_id);
 
 void __tsan_thread_lock(void * lock);
 
+// Try and timed locks, also of spin locks: takes the lock only if
+// the call returned "result" 0
+void __tsan_thread_trylock(void * lock, int result);
+
 void __tsan_thread_unlock(void * lock);
 
+void __tsan_thread_lock_destroy(void * lock);
+
+// Reader-writer locks. The try variants get the result of the call
+// and take the lock only if it is 0.
+void __tsan_rwlock_rdlock(void * lock);
+void __tsan_rwlock_wrlock(void * lock);
+void __tsan_rwlock_tryrdlock(void * lock, int result);
+void __tsan_rwlock_trywrlock(void * lock, int result);
+void __tsan_rwlock_unlock(void * lock);
+void __tsan_rwlock_destroy(void * lock);
+
+// Condition variables. A wait releases the mutex when it starts and
+// acquires it again when it returns with "result"; signals and
+// broadcasts both call __tsan_cond_signal.
+void __tsan_cond_wait_enter(void * cond, void * mutex);
+void __tsan_cond_wait(void * cond, void * mutex, int result);
+void __tsan_cond_signal(void * cond);
+void __tsan_cond_destroy(void * cond);
+
+// Barriers. pthread_barrier_init gives the number of threads that
+// each generation waits for; a wait arrives when it starts and
+// departs when it returns.
+void __tsan_barrier_init(void * barrier, unsigned count);
+void __tsan_barrier_wait_enter(void * barrier);
+void __tsan_barrier_wait(void * barrier);
+void __tsan_barrier_destroy(void * barrier);
+
+// Called before the program releases memory: free() and unsized
+// delete of blocks of the default allocator, whose size malloc knows,
+// sized delete of any heap block, munmap() of mappings.
+void __tsan_free(void * addr);
+
+void __tsan_free_sized(void * addr, unsigned long size);
+
+void __tsan_munmap(void * addr, unsigned long size);
+
 void __tsan_vptr_update(void **vptr_p, void *new_val ,
-                        int lineNo, void* objName, void * fileName);
+                        const __tsan_site *site);
 void __tsan_vptr_read(void **vptr_p,
-                      int lineNo, void* objName, void * fileName);
+                      const __tsan_site *site);
 
 // Code adapted from tsan of LLVM
-typedef char  __tsan_atomic8;
-typedef short __tsan_atomic16;  // NOLINT
-typedef int   __tsan_atomic32;
-
-typedef unsigned char   a8;
-typedef unsigned short  a16;  // NOLINT
-typedef unsigned int    a32;
-
+typedef char      __tsan_atomic8;
+typedef short     __tsan_atomic16;  // NOLINT
+typedef int       __tsan_atomic32;
+typedef long long __tsan_atomic64;  // NOLINT
 
 typedef enum {
   __tsan_memory_order_relaxed,
@@ -83,21 +137,72 @@ typedef enum {
   __tsan_memory_order_seq_cst
 } __tsan_memory_order;
 
-__tsan_atomic8  __tsan_atomic8_load(const volatile  __tsan_atomic8 *a,  __tsan_memory_order mo);
-__tsan_atomic16 __tsan_atomic16_load(const volatile __tsan_atomic16 *a, __tsan_memory_order mo);
-__tsan_atomic32 __tsan_atomic32_load(const volatile __tsan_atomic32 *a, __tsan_memory_order mo);
-
-void __tsan_unaligned_read2(const void *addr, int lineNo, void* objName, void * fileName);
-void __tsan_unaligned_read4(const void *addr, int lineNo, void* objName, void * fileName);
-void __tsan_unaligned_read8(const void *addr, int lineNo, void* objName, void * fileName);
-void __tsan_unaligned_read16(const void *addr, int lineNo, void* objName, void * fileName);
+// Atomic operations. Each performs the operation and synchronizes on
+// a clock of the location as its memory order says; relaxed ones do
+// no clock work.
+__tsan_atomic8 __tsan_atomic8_load(const volatile __tsan_atomic8 *a, __tsan_memory_order mo);
+void __tsan_atomic8_store(volatile __tsan_atomic8 *a, __tsan_atomic8 v, __tsan_memory_order mo);
+__tsan_atomic8 __tsan_atomic8_exchange(volatile __tsan_atomic8 *a, __tsan_atomic8 v, __tsan_memory_order mo);
+__tsan_atomic8 __tsan_atomic8_fetch_add(volatile __tsan_atomic8 *a, __tsan_atomic8 v, __tsan_memory_order mo);
+__tsan_atomic8 __tsan_atomic8_fetch_sub(volatile __tsan_atomic8 *a, __tsan_atomic8 v, __tsan_memory_order mo);
+__tsan_atomic8 __tsan_atomic8_fetch_and(volatile __tsan_atomic8 *a, __tsan_atomic8 v, __tsan_memory_order mo);
+__tsan_atomic8 __tsan_atomic8_fetch_or(volatile __tsan_atomic8 *a, __tsan_atomic8 v, __tsan_memory_order mo);
+__tsan_atomic8 __tsan_atomic8_fetch_xor(volatile __tsan_atomic8 *a, __tsan_atomic8 v, __tsan_memory_order mo);
+__tsan_atomic8 __tsan_atomic8_fetch_nand(volatile __tsan_atomic8 *a, __tsan_atomic8 v, __tsan_memory_order mo);
+__tsan_atomic8 __tsan_atomic8_compare_exchange_val(volatile __tsan_atomic8 *a, __tsan_atomic8 c, __tsan_atomic8 v,
+    __tsan_memory_order mo, __tsan_memory_order fmo);
 
-void __tsan_unaligned_write2(void *addr, int lineNo, void* objName, void * fileName);
-void __tsan_unaligned_write4(void *addr, int lineNo, void* objName, void * fileName);
-void __tsan_unaligned_write8(void *addr, int lineNo, void* objName, void * fileName);
-void __tsan_unaligned_write16(void *addr, int lineNo, void* objName, void * fileName);
+__tsan_atomic16 __tsan_atomic16_load(const volatile __tsan_atomic16 *a, __tsan_memory_order mo);
+void __tsan_atomic16_store(volatile __tsan_atomic16 *a, __tsan_atomic16 v, __tsan_memory_order mo);
+__tsan_atomic16 __tsan_atomic16_exchange(volatile __tsan_atomic16 *a, __tsan_atomic16 v, __tsan_memory_order mo);
+__tsan_atomic16 __tsan_atomic16_fetch_add(volatile __tsan_atomic16 *a, __tsan_atomic16 v, __tsan_memory_order mo);
+__tsan_atomic16 __tsan_atomic16_fetch_sub(volatile __tsan_atomic16 *a, __tsan_atomic16 v, __tsan_memory_order mo);
+__tsan_atomic16 __tsan_atomic16_fetch_and(volatile __tsan_atomic16 *a, __tsan_atomic16 v, __tsan_memory_order mo);
+__tsan_atomic16 __tsan_atomic16_fetch_or(volatile __tsan_atomic16 *a, __tsan_atomic16 v, __tsan_memory_order mo);
+__tsan_atomic16 __tsan_atomic16_fetch_xor(volatile __tsan_atomic16 *a, __tsan_atomic16 v, __tsan_memory_order mo);
+__tsan_atomic16 __tsan_atomic16_fetch_nand(volatile __tsan_atomic16 *a, __tsan_atomic16 v, __tsan_memory_order mo);
+__tsan_atomic16 __tsan_atomic16_compare_exchange_val(volatile __tsan_atomic16 *a, __tsan_atomic16 c, __tsan_atomic16 v,
+    __tsan_memory_order mo, __tsan_memory_order fmo);
 
-a8 __tsan_atomic32_fetch_add(volatile a8 *a, a8 v, __tsan_memory_order mo);
+__tsan_atomic32 __tsan_atomic32_load(const volatile __tsan_atomic32 *a, __tsan_memory_order mo);
+void __tsan_atomic32_store(volatile __tsan_atomic32 *a, __tsan_atomic32 v, __tsan_memory_order mo);
+__tsan_atomic32 __tsan_atomic32_exchange(volatile __tsan_atomic32 *a, __tsan_atomic32 v, __tsan_memory_order mo);
+__tsan_atomic32 __tsan_atomic32_fetch_add(volatile __tsan_atomic32 *a, __tsan_atomic32 v, __tsan_memory_order mo);
+__tsan_atomic32 __tsan_atomic32_fetch_sub(volatile __tsan_atomic32 *a, __tsan_atomic32 v, __tsan_memory_order mo);
+__tsan_atomic32 __tsan_atomic32_fetch_and(volatile __tsan_atomic32 *a, __tsan_atomic32 v, __tsan_memory_order mo);
+__tsan_atomic32 __tsan_atomic32_fetch_or(volatile __tsan_atomic32 *a, __tsan_atomic32 v, __tsan_memory_order mo);
+__tsan_atomic32 __tsan_atomic32_fetch_xor(volatile __tsan_atomic32 *a, __tsan_atomic32 v, __tsan_memory_order mo);
+__tsan_atomic32 __tsan_atomic32_fetch_nand(volatile __tsan_atomic32 *a, __tsan_atomic32 v, __tsan_memory_order mo);
+__tsan_atomic32 __tsan_atomic32_compare_exchange_val(volatile __tsan_atomic32 *a, __tsan_atomic32 c, __tsan_atomic32 v,
+    __tsan_memory_order mo, __tsan_memory_order fmo);
+
+__tsan_atomic64 __tsan_atomic64_load(const volatile __tsan_atomic64 *a, __tsan_memory_order mo);
+void __tsan_atomic64_store(volatile __tsan_atomic64 *a, __tsan_atomic64 v, __tsan_memory_order mo);
+__tsan_atomic64 __tsan_atomic64_exchange(volatile __tsan_atomic64 *a, __tsan_atomic64 v, __tsan_memory_order mo);
+__tsan_atomic64 __tsan_atomic64_fetch_add(volatile __tsan_atomic64 *a, __tsan_atomic64 v, __tsan_memory_order mo);
+__tsan_atomic64 __tsan_atomic64_fetch_sub(volatile __tsan_atomic64 *a, __tsan_atomic64 v, __tsan_memory_order mo);
+__tsan_atomic64 __tsan_atomic64_fetch_and(volatile __tsan_atomic64 *a, __tsan_atomic64 v, __tsan_memory_order mo);
+__tsan_atomic64 __tsan_atomic64_fetch_or(volatile __tsan_atomic64 *a, __tsan_atomic64 v, __tsan_memory_order mo);
+__tsan_atomic64 __tsan_atomic64_fetch_xor(volatile __tsan_atomic64 *a, __tsan_atomic64 v, __tsan_memory_order mo);
+__tsan_atomic64 __tsan_atomic64_fetch_nand(volatile __tsan_atomic64 *a, __tsan_atomic64 v, __tsan_memory_order mo);
+__tsan_atomic64 __tsan_atomic64_compare_exchange_val(volatile __tsan_atomic64 *a, __tsan_atomic64 c, __tsan_atomic64 v,
+    __tsan_memory_order mo, __tsan_memory_order fmo);
+
+// A release fence makes the later relaxed stores of its thread release,
+// an acquire fence makes its earlier relaxed loads acquire. Signal
+// fences order nothing between threads.
+void __tsan_atomic_thread_fence(__tsan_memory_order mo);
+void __tsan_atomic_signal_fence(__tsan_memory_order mo);
+
+void __tsan_unaligned_read2(const void *addr, const __tsan_site *site);
+void __tsan_unaligned_read4(const void *addr, const __tsan_site *site);
+void __tsan_unaligned_read8(const void *addr, const __tsan_site *site);
+void __tsan_unaligned_read16(const void *addr, const __tsan_site *site);
+
+void __tsan_unaligned_write2(void *addr, const __tsan_site *site);
+void __tsan_unaligned_write4(void *addr, const __tsan_site *site);
+void __tsan_unaligned_write8(void *addr, const __tsan_site *site);
+void __tsan_unaligned_write16(void *addr, const __tsan_site *site);
 
 #ifdef __cplusplus
 }  // extern "C"
@@ -0,0 +1,472 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Vector clocks with SIMD join and copy kernels.
+//
+// The entries of a clock are kept 32-byte aligned and its capacity is
+// padded to whole SIMD registers. Entries past the size are zero, so
+// the kernels always run over whole registers, with no tail loop.
+// Entries are joined as unsigned values: an epoch c@t and the zero
+// padding then never lower an entry, and two epochs of the same
+// thread t compare by their clocks c, whatever the sign of t's bits.
+//
+// The kernel is chosen at compile time: NEON on ARMv7, AVX2, SSE4.1 or
+// SSE2 on x86_64 and a portable scalar loop otherwise, e.g. for 64-bit
+// epochs, which ARMv7 NEON and AVX2 cannot compare unsigned.
+
+#ifndef ETSAN_VECTOR_CLOCK_H_
+#define ETSAN_VECTOR_CLOCK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <initializer_list>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ETSAN_VC_NEON 1
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define ETSAN_VC_AVX2 1
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#define ETSAN_VC_SSE4 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define ETSAN_VC_SSE2 1
+#endif
+
+#include "metadata_allocator.h"
+
+namespace vclock {
+
+static const size_t kAlign = 32; // bytes: one AVX2 or two NEON/SSE registers
+
+// dst[i] = max(a[i], b[i]) for i < n, n a multiple of kAlign / 4.
+// dst may be a.
+inline void join(uint32_t * dst, const uint32_t * a, const uint32_t * b,
+                 size_t n) {
+#if defined(ETSAN_VC_NEON)
+  for (size_t i = 0; i < n; i += 4) {
+    vst1q_u32(dst + i, vmaxq_u32(vld1q_u32(a + i), vld1q_u32(b + i)));
+  }
+#elif defined(ETSAN_VC_AVX2)
+  for (size_t i = 0; i < n; i += 8) {
+    __m256i d = _mm256_load_si256((const __m256i*)(a + i));
+    __m256i s = _mm256_load_si256((const __m256i*)(b + i));
+    _mm256_store_si256((__m256i*)(dst + i), _mm256_max_epu32(d, s));
+  }
+#elif defined(ETSAN_VC_SSE4)
+  for (size_t i = 0; i < n; i += 4) {
+    __m128i d = _mm_load_si128((const __m128i*)(a + i));
+    __m128i s = _mm_load_si128((const __m128i*)(b + i));
+    _mm_store_si128((__m128i*)(dst + i), _mm_max_epu32(d, s));
+  }
+#elif defined(ETSAN_VC_SSE2)
+  // no unsigned max: flip the sign bits and select by a signed compare
+  const __m128i sign = _mm_set1_epi32((int)0x80000000);
+  for (size_t i = 0; i < n; i += 4) {
+    __m128i d = _mm_load_si128((const __m128i*)(a + i));
+    __m128i s = _mm_load_si128((const __m128i*)(b + i));
+    __m128i gt = _mm_cmpgt_epi32(_mm_xor_si128(s, sign), _mm_xor_si128(d, sign));
+    _mm_store_si128((__m128i*)(dst + i),
+                    _mm_or_si128(_mm_and_si128(gt, s), _mm_andnot_si128(gt, d)));
+  }
+#else
+  for (size_t i = 0; i < n; i++) {
+    dst[i] = b[i] > a[i] ? b[i] : a[i]; // branch free, vectorizable
+  }
+#endif
+}
+
+// dst[i] = max(a[i], b[i]) for i < n, n a multiple of kAlign / 8.
+// dst may be a.
+inline void join(uint64_t * dst, const uint64_t * a, const uint64_t * b,
+                 size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    dst[i] = b[i] > a[i] ? b[i] : a[i]; // branch free, vectorizable
+  }
+}
+
+// dst[i] = src[i] for i < n, n a multiple of kAlign / sizeof(E)
+template <typename E>
+inline void copy(E * dst, const E * src, size_t n) {
+#if defined(ETSAN_VC_NEON)
+  const uint32_t * s = (const uint32_t*)src;
+  uint32_t * d = (uint32_t*)dst;
+  for (size_t i = 0; i < n * sizeof(E) / 4; i += 4) {
+    vst1q_u32(d + i, vld1q_u32(s + i));
+  }
+#elif defined(ETSAN_VC_AVX2)
+  for (size_t i = 0; i < n * sizeof(E); i += 32) {
+    _mm256_store_si256((__m256i*)((char*)dst + i),
+                       _mm256_load_si256((const __m256i*)((const char*)src + i)));
+  }
+#elif defined(ETSAN_VC_SSE4) || defined(ETSAN_VC_SSE2)
+  for (size_t i = 0; i < n * sizeof(E); i += 16) {
+    _mm_store_si128((__m128i*)((char*)dst + i),
+                    _mm_load_si128((const __m128i*)((const char*)src + i)));
+  }
+#else
+  memcpy(dst, src, n * sizeof(E));
+#endif
+}
+
+} // namespace vclock
+
+// A vector of epochs E in an aligned, zero padded buffer allocated
+// from MetaAlloc. It keeps the subset of the std::vector interface
+// the runtime uses.
+//
+// Buffers are reference counted, so that a clock can share() the
+// buffer of another one instead of copying it. The methods that
+// change the size or join/copy give the clock a buffer of its own
+// first (copy on write). Writes through [], at() and data() do NOT,
+// they are seen by all clocks sharing the buffer.
+template <typename E>
+class PaddedVectorClock {
+
+public:
+
+  // the unsigned type of the join kernels
+  using U = typename std::conditional<sizeof(E) == 4, uint32_t, uint64_t>::type;
+
+  // entries per kAlign bytes
+  static const size_t kLanes = vclock::kAlign / sizeof(E);
+
+  // no entry, e.g. nothing to skip
+  static const size_t kNoEntry = (size_t)-1;
+
+  PaddedVectorClock() {}
+
+  PaddedVectorClock(const PaddedVectorClock & other) { *this = other; }
+
+  PaddedVectorClock(PaddedVectorClock && other) { swap(other); }
+
+  PaddedVectorClock(std::initializer_list<E> epochs) { *this = epochs; }
+
+  ~PaddedVectorClock() { release(); }
+
+  PaddedVectorClock & operator=(const PaddedVectorClock & other) {
+    if (this != &other) {
+      clear();
+      reserve(other.n);
+      if (other.n) vclock::copy(entries, other.entries, padded(other.n));
+      n = other.n;
+    }
+    return *this;
+  }
+
+  PaddedVectorClock & operator=(PaddedVectorClock && other) {
+    swap(other);
+    return *this;
+  }
+
+  PaddedVectorClock & operator=(std::initializer_list<E> epochs) {
+    clear();
+    for (E epoch : epochs) push_back(epoch);
+    return *this;
+  }
+
+  void swap(PaddedVectorClock & other) {
+    std::swap(entries, other.entries);
+    std::swap(n, other.n);
+    std::swap(cap, other.cap);
+  }
+
+  size_t size() const { return n; }
+  size_t capacity() const { return cap; }
+  bool empty() const { return n == 0; }
+
+  E * data() { return entries; }
+  const E * data() const { return entries; }
+
+  E & operator[](size_t i) { return entries[i]; }
+  const E & operator[](size_t i) const { return entries[i]; }
+
+  E & at(size_t i) {
+    if (i >= n) throw std::out_of_range("PaddedVectorClock::at");
+    return entries[i];
+  }
+
+  const E & at(size_t i) const {
+    if (i >= n) throw std::out_of_range("PaddedVectorClock::at");
+    return entries[i];
+  }
+
+  E * begin() { return entries; }
+  E * end() { return entries + n; }
+  const E * begin() const { return entries; }
+  const E * end() const { return entries + n; }
+
+  // Entry "skip" of a shared buffer is not read: the new one has 0
+  // there, see SharedVectorClock.
+  void reserve(size_t size, size_t skip = kNoEntry) {
+    if (size <= cap && !shared()) return;
+    size_t newCap = size <= cap ? cap : padded(size > 2 * cap ? size : 2 * cap);
+    E * grown = allocate(newCap);
+    if (n) copyEntries(grown, entries, padded(n), skip);
+    const size_t used = n;
+    release();
+    entries = grown;
+    n = used;
+    cap = newCap;
+  }
+
+  // New entries are zero, as with std::vector
+  void resize(size_t size) {
+    reserve(size);
+    if (size < n) memset(entries + size, 0, (n - size) * sizeof(E));
+    n = size;
+  }
+
+  void push_back(E epoch) {
+    reserve(n + 1);
+    entries[n++] = epoch;
+  }
+
+  void clear() {
+    if (shared()) release();
+    resize(0);
+  }
+
+  // Makes this clock use the buffer of "other" until either of them
+  // is changed by a method below or above.
+  void share(const PaddedVectorClock & other) {
+    if (entries == other.entries) return;
+    release();
+    entries = other.entries;
+    n = other.n;
+    cap = other.cap;
+    if (entries) header()->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // True if other clocks use the buffer of this clock too
+  bool shared() const {
+    return entries && header()->refs.load(std::memory_order_acquire) > 1;
+  }
+
+  // this[i] = max(this[i], other[i]): a join of unsigned epochs. A
+  // shared buffer is not copied first: the join writes a new one.
+  // Entry "skip" of other is not read, this[skip] is kept.
+  // NOTE: size() >= other.size() must hold.
+  void join(const PaddedVectorClock & other, size_t skip = kNoEntry) {
+    if (!other.n || entries == other.entries) return;
+    const size_t joined = padded(other.n);
+    if (!shared()) {
+      joinEntries(entries, entries, other.entries, joined, skip);
+      return;
+    }
+    E * own = allocate(cap);
+    joinEntries(own, entries, other.entries, joined, skip);
+    if (padded(n) > joined) {
+      vclock::copy(own + joined, entries + joined, padded(n) - joined);
+    }
+    const size_t used = n, owned = cap;
+    release();
+    entries = own;
+    n = used;
+    cap = owned;
+  }
+
+  // this[i] = other[i]. NOTE: size() == other.size() must hold.
+  void copy(const PaddedVectorClock & other) {
+    if (shared()) reserve(n);
+    if (other.n) vclock::copy(entries, other.entries, padded(other.n));
+  }
+
+private:
+
+  // Reference count in the kAlign bytes before the entries
+  struct Header {
+    std::atomic<unsigned> refs;
+  };
+
+  E * entries = nullptr;
+  size_t n = 0;   // entries in use
+  size_t cap = 0; // a multiple of kLanes, entries past n are 0
+
+  static size_t padded(size_t size) {
+    return (size + kLanes - 1) / kLanes * kLanes;
+  }
+
+  // vclock::join of n entries, but b[skip] is not read: dst[skip] =
+  // a[skip]. Only the registers of the other entries are vectorized.
+  static void joinEntries(E * dst, const E * a, const E * b, size_t n,
+                          size_t skip) {
+    if (skip >= n) {
+      vclock::join((U*)dst, (const U*)a, (const U*)b, n);
+      return;
+    }
+    const size_t lane = skip / kLanes * kLanes, next = lane + kLanes;
+    vclock::join((U*)dst, (const U*)a, (const U*)b, lane);
+    for (size_t i = lane; i < next; i++) {
+      dst[i] = i != skip && (U)b[i] > (U)a[i] ? b[i] : a[i];
+    }
+    vclock::join((U*)dst + next, (const U*)a + next, (const U*)b + next,
+                 n - next);
+  }
+
+  // vclock::copy of n entries, but src[skip] is not read: dst[skip]
+  // is left as is
+  static void copyEntries(E * dst, const E * src, size_t n, size_t skip) {
+    if (skip >= n) {
+      vclock::copy(dst, src, n);
+      return;
+    }
+    const size_t lane = skip / kLanes * kLanes, next = lane + kLanes;
+    vclock::copy(dst, src, lane);
+    for (size_t i = lane; i < next; i++) {
+      if (i != skip) dst[i] = src[i];
+    }
+    vclock::copy(dst + next, src + next, n - next);
+  }
+
+  static size_t bufferBytes(size_t capacity) {
+    return vclock::kAlign + capacity * sizeof(E);
+  }
+
+  Header * header() const {
+    return (Header*)((char*)entries - vclock::kAlign);
+  }
+
+  // A zeroed buffer of "capacity" entries, referenced once. Blocks
+  // of MetaAlloc are aligned to their size class, so the entries
+  // after the header are kAlign aligned.
+  static E * allocate(size_t capacity) {
+    char * block = (char*)MetaAlloc.allocate(bufferBytes(capacity));
+    new (block) Header();
+    ((Header*)block)->refs.store(1, std::memory_order_relaxed);
+    E * fresh = (E*)(block + vclock::kAlign);
+    memset(fresh, 0, capacity * sizeof(E));
+    return fresh;
+  }
+
+  void release() {
+    if (entries && header()->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      MetaAlloc.deallocate(header(), bufferBytes(cap));
+    }
+    entries = nullptr;
+    n = cap = 0;
+  }
+};
+
+// Clock of a lock: the clock of its last releaser, shared rather than
+// copied at each release. The releaser keeps incrementing its own
+// entry in the shared buffer, so the value of that entry at release
+// time is kept here and overrides the buffer. That entry is written
+// concurrently, outside the guard of the lock: it is never read from
+// the buffer, the joins and copies below skip it.
+template <typename E>
+class SharedVectorClock {
+
+public:
+
+  using U = typename PaddedVectorClock<E>::U;
+
+  SharedVectorClock() {}
+
+  SharedVectorClock(std::initializer_list<E> epochs) : C(epochs) {}
+
+  SharedVectorClock & operator=(std::initializer_list<E> epochs) {
+    C = epochs;
+    owner = kNoOwner;
+    return *this;
+  }
+
+  size_t size() const { return C.size(); }
+  size_t capacity() const { return C.capacity(); }
+  bool empty() const { return C.empty(); }
+
+  E operator[](size_t i) const { return i == owner ? ownerEntry : C[i]; }
+
+  E at(size_t i) const {
+    if (i >= size()) throw std::out_of_range("SharedVectorClock::at");
+    return (*this)[i];
+  }
+
+  // Writable entry; the clock gets a buffer of its own first
+  E & operator[](size_t i) {
+    unshare();
+    return C[i];
+  }
+
+  void resize(size_t size) {
+    unshare();
+    C.resize(size);
+  }
+
+  void push_back(E epoch) {
+    unshare();
+    C.push_back(epoch);
+  }
+
+  // this := c, by sharing the buffer of c; entry i of c keeps its
+  // current value. The owner of c goes on writing entry i in place,
+  // with no synchronization with the readers of this clock, which is
+  // why entry i of the buffer is never read here. Other entries of c
+  // must not change until c is joined or resized, which gives c a
+  // buffer of its own.
+  void copyFrom(const PaddedVectorClock<E> & c, size_t i) {
+    C.share(c);
+    owner = i < c.size() ? i : kNoOwner;
+    if (owner != kNoOwner) ownerEntry = c[i];
+  }
+
+  // this[i] = epoch, for a releaser i that released this clock and
+  // learned nothing since: its own entry is all that changed.
+  void advance(size_t i, E epoch) {
+    if (i == owner) ownerEntry = epoch;
+    else (*this)[i] = epoch;
+  }
+
+  // this := this U c, keeping the earlier releases.
+  // NOTE: size() >= c.size() must hold.
+  void join(const PaddedVectorClock<E> & c) {
+    unshare();
+    C.join(c);
+  }
+
+  // t[i] = max(t[i], this[i]). NOTE: t.size() >= size() must hold.
+  void joinInto(PaddedVectorClock<E> & t) const {
+    if (owner == kNoOwner) {
+      t.join(C);
+      return;
+    }
+    if (t.data() == C.data()) return; // the releaser: knows it all
+    const E mine = t[owner];
+    t.join(C, owner);
+    t[owner] = (U)mine > (U)ownerEntry ? mine : ownerEntry;
+  }
+
+private:
+
+  static const size_t kNoOwner = (size_t)-1;
+
+  PaddedVectorClock<E> C;
+  size_t owner = kNoOwner; // entry overridden by ownerEntry
+  E ownerEntry = 0;
+
+  void unshare() {
+    if (owner == kNoOwner) return;
+    C.reserve(C.size(), owner);
+    C[owner] = ownerEntry;
+    owner = kNoOwner;
+  }
+};
+
+#endif // ETSAN_VECTOR_CLOCK_H_
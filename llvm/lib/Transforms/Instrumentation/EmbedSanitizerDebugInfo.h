@@ -50,8 +50,10 @@
 #include "llvm/Pass.h"
 #include <iostream>
 #include <fstream>
+#include <map>
 #include <memory>
 #include <string>
+#include <tuple>
 #include <cxxabi.h>
 
 // Implements helper functions for manipulating debugging
@@ -111,7 +113,7 @@ std::string createAbsoluteFileName(
   /**
    * Returns the name of the file which an instruction belongs to.
    */
-  llvm::Value* getFileName(llvm::Instruction *I) {
+  std::string getFileName(llvm::Instruction *I) {
 
     std::string name = "Unknown";
     std::string dirName = "";
@@ -126,27 +128,9 @@ std::string createAbsoluteFileName(
          name    = createAbsoluteFileName(dirName, name);
       }
     }
-
-    llvm::Function *F = I->getFunction();
-    llvm::IRBuilder<> IRB(F->getEntryBlock().getFirstNonPHI());
-
-    return IRB.CreateGlobalStringPtr(name, "fName");
+    return name;
   }
 
-/**
- * Returns name of the function under instrumentation
- * as a value. The name is retrieved later at runtime.
- */
-llvm::Value* getFuncName(llvm::Function &F) {
-  llvm::StringRef name = demangleName(F.getName());
-  auto idx = name.find('(');
-  if (idx != llvm::StringRef::npos) {
-    name = name.substr(0, idx);
-  }
-  llvm::IRBuilder<> IRB( F.getEntryBlock().getFirstNonPHI() );
-  return IRB.CreateGlobalStringPtr(name, "func_name");
-}
-
 /**
  * Return function name as a string
  */
@@ -163,40 +147,102 @@ llvm::StringRef getFuncNameStr(llvm::Function &F) {
    * Returns the name of the memory location involved.
    * By object, this refers to the name of the variable.
    */
-  llvm::Value * getObjectName(
-      llvm::Value *V,
-      llvm::Instruction *I,
-      const llvm::DataLayout &DL) {
-
-    llvm::Value *obj  = GetUnderlyingObject(V, DL);
-    llvm::Function *F = I->getFunction();
-    llvm::IRBuilder<> IRB( F->getEntryBlock().getFirstNonPHI() );
-
-    if ( !obj ) {
-      return IRB.CreateGlobalStringPtr("unknown", "variable");
-    } else {
-      return IRB.CreateGlobalStringPtr(obj->getName(), "variable");
-    }
+  std::string getObjectName(llvm::Value *V, const llvm::DataLayout &DL) {
+    llvm::Value *obj = GetUnderlyingObject(V, DL);
+    return obj ? obj->getName().str() : "unknown";
   }
 
   /**
    * Retrieves the line number of the instruction
    * being instrumented.
    */
-  llvm::Value* getLineNumber(llvm::Instruction *I) {
-
+  unsigned getLineNumber(llvm::Instruction *I) {
     if (auto Loc = I->getDebugLoc()) { // Here I is an LLVM instruction
-      llvm::IRBuilder<> IRB(I);
-      unsigned Line = Loc->getLine();
-      return llvm::ConstantInt::get(
-          llvm::Type::getInt32Ty(I->getContext()),
-          Line);
-    } else {
-      llvm::Constant* zero = llvm::ConstantInt::get(
-          llvm::Type::getInt32Ty(I->getContext()),
-          0);
-      return zero;
+      return Loc->getLine();
     }
+    return 0;
   }
 
+  /**
+   * Site descriptors of the instrumented accesses of a module. A site
+   * is a constant {line, file, object, function} (the __tsan_site of
+   * the runtime) in the section etsan_sites. Accesses pass its address
+   * as their site ID, and the runtime reads it only to report a race.
+   * Accesses with the same debug information share a site, and the
+   * sites and function names share one global per distinct string.
+   */
+  class SiteTable {
+  public:
+
+    // Forgets the sites and strings of the previous module
+    void reset() {
+      Sites.clear();
+      Strings.clear();
+    }
+
+    // Returns the name of F as a constant C string, as an i8*. The name
+    // is retrieved later at runtime.
+    llvm::Constant * getFuncName(llvm::Function &F) {
+      return getString(*F.getParent(), getFuncNameStr(F).str());
+    }
+
+    // Returns the site ID, as an i8*, of access I to V
+    llvm::Constant * get(llvm::Value *V, llvm::Instruction *I,
+                         const llvm::DataLayout &DL) {
+      llvm::Function *F = I->getFunction();
+      Key key(getLineNumber(I), getFileName(I), getObjectName(V, DL),
+              getFuncNameStr(*F).str());
+
+      auto site = Sites.find(key);
+      if (site != Sites.end()) return site->second;
+
+      llvm::Module *M = F->getParent();
+      llvm::LLVMContext &C = M->getContext();
+      llvm::Type *Int8PtrTy = llvm::Type::getInt8PtrTy(C);
+      llvm::StructType *SiteTy = llvm::StructType::get(C,
+          {llvm::Type::getInt32Ty(C), Int8PtrTy, Int8PtrTy, Int8PtrTy});
+
+      llvm::Constant *fields[] = {
+        llvm::ConstantInt::get(llvm::Type::getInt32Ty(C), std::get<0>(key)),
+        getString(*M, std::get<1>(key)),
+        getString(*M, std::get<2>(key)),
+        getString(*M, std::get<3>(key))
+      };
+      auto *GV = new llvm::GlobalVariable(*M, SiteTy, true,
+          llvm::GlobalValue::PrivateLinkage,
+          llvm::ConstantStruct::get(SiteTy, fields), "etsan_site");
+      GV->setSection("etsan_sites");
+
+      llvm::Constant *id = llvm::ConstantExpr::getPointerCast(GV, Int8PtrTy);
+      Sites[key] = id;
+      return id;
+    }
+
+  private:
+
+    // line, file, object, function
+    typedef std::tuple<unsigned, std::string, std::string, std::string> Key;
+    std::map<Key, llvm::Constant *> Sites;
+
+    std::map<std::string, llvm::Constant *> Strings;
+
+    // Returns the constant C string str of module M, as an i8*,
+    // creating its global on first use
+    llvm::Constant * getString(llvm::Module &M, const std::string &str) {
+      auto string = Strings.find(str);
+      if (string != Strings.end()) return string->second;
+
+      llvm::Constant *init = llvm::ConstantDataArray::getString(
+          M.getContext(), str);
+      auto *GV = new llvm::GlobalVariable(M, init->getType(), true,
+          llvm::GlobalValue::PrivateLinkage, init, "etsan_str");
+      GV->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+
+      llvm::Constant *ptr = llvm::ConstantExpr::getPointerCast(
+          GV, llvm::Type::getInt8PtrTy(M.getContext()));
+      Strings[str] = ptr;
+      return ptr;
+    }
+  };
+
 } // end EmbedSanitizer
@@ -0,0 +1,292 @@
+//===-- Extension to ThreadSanitizer.cpp - detecting races, Embeded ARM --===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021  Hassan Salehe Matar
+//            Email: hassansalehe@gmail.com
+//
+//===----------------------------------------------------------------------===//
+
+
+#include "llvm/Analysis/MemoryBuiltins.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+
+// Implements the thread-escape analysis of EmbedSanitizer: finds the
+// memory that only the thread which allocated it can ever access.
+namespace EmbedSanitizer {
+
+  /**
+   * Interprocedural escape analysis of the stack and heap objects of a
+   * module. An object escapes if a pointer to it is stored to memory,
+   * converted to an integer, or passed to a function that may keep it,
+   * e.g. pthread_create. Pointers are followed through the arguments
+   * and the returns of the functions defined in the module:
+   *  - an argument escapes if the function lets it escape;
+   *  - a call returns an argument if the function may return it;
+   *  - a function returns a fresh object if it returns only heap
+   *    objects it allocated and did not let escape, like a wrapper of
+   *    malloc: its calls allocate too;
+   *  - an argument points to thread-local memory if the function is
+   *    only called directly, from this module, with such memory.
+   * Other functions keep the pointers they get unless their parameter
+   * is nocapture. Accesses to an object that does not escape, nor is
+   * returned, cannot race: only one thread ever has its address.
+   */
+  class ThreadEscapeAnalysis {
+  public:
+
+    // Summarizes the functions of M, before the pass changes them
+    void analyze(llvm::Module &M, const llvm::TargetLibraryInfo &TLI) {
+      const llvm::DataLayout &DL = M.getDataLayout();
+      Summaries.clear();
+      Cache.clear();
+      for (llvm::Function &F : M) {
+        if (F.isDeclaration() || !F.hasExactDefinition()) continue;
+        Summary &S = Summaries[&F];
+        S.ArgEscapes.assign(F.arg_size(), false);
+        S.ArgReturned.assign(F.arg_size(), false);
+        S.ArgLocal.assign(F.arg_size(), false);
+        S.FreshReturn = F.getReturnType()->isPointerTy();
+      }
+
+      // escapes and returns only add up: from none to the least fixpoint
+      for (bool changed = true; changed; ) {
+        changed = false;
+        for (auto &entry : Summaries) {
+          Summary &S = entry.second;
+          for (llvm::Argument &A : entry.first->args()) {
+            const unsigned i = A.getArgNo();
+            if (!A.getType()->isPointerTy() || S.ArgEscapes[i]) continue;
+            Flow flow = follow(&A, TLI);
+            if (flow.Escapes || (flow.Returned && !S.ArgReturned[i])) {
+              S.ArgEscapes[i] = flow.Escapes;
+              if (flow.Returned) S.ArgReturned[i] = true;
+              changed = true;
+            }
+          }
+        }
+      }
+
+      // fresh returns and local arguments only drop: from all to the
+      // greatest fixpoint
+      for (bool changed = true; changed; ) {
+        changed = false;
+        for (auto &entry : Summaries) {
+          if (entry.second.FreshReturn &&
+              !returnsFresh(*entry.first, DL, TLI)) {
+            entry.second.FreshReturn = false;
+            changed = true;
+          }
+        }
+      }
+
+      for (auto &entry : Summaries) {
+        const llvm::Function &F = *entry.first;
+        if (!F.hasLocalLinkage() || F.hasAddressTaken()) continue;
+        for (const llvm::Argument &A : F.args())
+          entry.second.ArgLocal[A.getArgNo()] = A.getType()->isPointerTy();
+      }
+      for (bool changed = true; changed; ) {
+        changed = false;
+        Cache.clear(); // may hold arguments found local meanwhile
+        for (auto &entry : Summaries) {
+          Summary &S = entry.second;
+          for (llvm::User *U : entry.first->users()) {
+            llvm::CallSite CS(U); // a direct call: no address taken
+            for (unsigned i = 0; i < S.ArgLocal.size(); i++) {
+              if (S.ArgLocal[i] &&
+                  !isThreadLocal(CS.getArgument(i), DL, TLI)) {
+                S.ArgLocal[i] = false;
+                changed = true;
+              }
+            }
+          }
+        }
+      }
+      Cache.clear();
+    }
+
+    // Forgets the objects of the previous function, which may have
+    // been changed since
+    void startFunction() { Cache.clear(); }
+
+    // Whether all the objects that Addr may point to are thread-local
+    bool isThreadLocal(llvm::Value *Addr, const llvm::DataLayout &DL,
+                       const llvm::TargetLibraryInfo &TLI) {
+      llvm::SmallVector<llvm::Value *, 4> objects;
+      llvm::GetUnderlyingObjects(Addr, objects, DL);
+      for (llvm::Value *object : objects) {
+        if (!isLocalObject(object, TLI)) return false;
+      }
+      return true;
+    }
+
+  private:
+
+    struct Summary {
+      llvm::SmallVector<bool, 4> ArgEscapes;  // may be kept or shared
+      llvm::SmallVector<bool, 4> ArgReturned; // may be returned
+      llvm::SmallVector<bool, 4> ArgLocal;    // gets thread-local memory
+      bool FreshReturn;                       // returns fresh heap objects
+    };
+    llvm::DenseMap<llvm::Function *, Summary> Summaries;
+
+    // objects of the current function found thread-local or not
+    llvm::DenseMap<const llvm::Value *, bool> Cache;
+
+    // Where a pointer goes in its function
+    struct Flow {
+      bool Escapes = false;
+      bool Returned = false;
+    };
+
+    // Follows pointer V and the pointers derived from it in its function
+    Flow follow(llvm::Value *V, const llvm::TargetLibraryInfo &TLI) const {
+      Flow flow;
+      llvm::SmallVector<llvm::Value *, 16> worklist;
+      llvm::SmallPtrSet<llvm::Value *, 16> visited;
+      auto push = [&](llvm::Value *P) {
+        if (visited.insert(P).second) worklist.push_back(P);
+      };
+      push(V);
+
+      while (!worklist.empty()) {
+        llvm::Value *P = worklist.pop_back_val();
+        for (llvm::Use &U : P->uses()) {
+          auto *I = llvm::dyn_cast<llvm::Instruction>(U.getUser());
+          if (!I) {
+            flow.Escapes = true;
+            return flow;
+          }
+          switch (I->getOpcode()) {
+          case llvm::Instruction::Load:
+          case llvm::Instruction::ICmp:
+            break;
+          case llvm::Instruction::Store:
+            // the stored value escapes, the address is only accessed
+            if (U.getOperandNo() == 0) {
+              flow.Escapes = true;
+              return flow;
+            }
+            break;
+          case llvm::Instruction::AtomicRMW:
+          case llvm::Instruction::AtomicCmpXchg:
+            if (U.getOperandNo() != 0) {
+              flow.Escapes = true;
+              return flow;
+            }
+            break;
+          case llvm::Instruction::GetElementPtr:
+          case llvm::Instruction::BitCast:
+          case llvm::Instruction::AddrSpaceCast:
+          case llvm::Instruction::PHI:
+          case llvm::Instruction::Select:
+            push(I);
+            break;
+          case llvm::Instruction::Ret:
+            flow.Returned = true;
+            break;
+          case llvm::Instruction::Call:
+          case llvm::Instruction::Invoke:
+            if (!followCall(llvm::CallSite(I), U, push, TLI)) {
+              flow.Escapes = true;
+              return flow;
+            }
+            break;
+          default:
+            flow.Escapes = true;
+            return flow;
+          }
+        }
+      }
+      return flow;
+    }
+
+    // Follows pointer argument U of call CS. Returns false if it escapes.
+    template <typename Push>
+    bool followCall(llvm::CallSite CS, llvm::Use &U, Push push,
+                    const llvm::TargetLibraryInfo &TLI) const {
+      llvm::Instruction *I = CS.getInstruction();
+      if (CS.isCallee(&U)) return false;
+      if (llvm::isa<llvm::DbgInfoIntrinsic>(I)) return true;
+      if (llvm::isFreeCall(I, &TLI)) return true;
+
+      const unsigned i = CS.getArgumentNo(&U);
+      llvm::Function *callee = CS.getCalledFunction();
+      // callbacks of the runtime, e.g. __tsan_free or the lock ones the
+      // pass inserts, only use the address as a key: the answer must
+      // not depend on whether they were inserted yet
+      if (callee && callee->getName().startswith("__tsan_")) return true;
+      auto S = callee ? Summaries.find(callee) : Summaries.end();
+      if (S != Summaries.end() && i < S->second.ArgEscapes.size()) {
+        if (S->second.ArgEscapes[i]) return false;
+        if (S->second.ArgReturned[i]) push(I);
+        return true;
+      }
+      // keeps no copy after the call: neither returns nor shares it
+      return CS.doesNotCapture(i);
+    }
+
+    // Whether V is a heap object allocated by its call
+    bool isAllocation(llvm::Value *V,
+                      const llvm::TargetLibraryInfo &TLI) const {
+      if (llvm::isMallocLikeFn(V, &TLI) || llvm::isCallocLikeFn(V, &TLI))
+        return true;
+      llvm::CallSite CS(V);
+      llvm::Function *callee = CS ? CS.getCalledFunction() : nullptr;
+      auto S = callee ? Summaries.find(callee) : Summaries.end();
+      return S != Summaries.end() && S->second.FreshReturn;
+    }
+
+    // Whether F returns only null or heap objects it allocated and did
+    // not let escape
+    bool returnsFresh(llvm::Function &F, const llvm::DataLayout &DL,
+                      const llvm::TargetLibraryInfo &TLI) const {
+      for (llvm::BasicBlock &BB : F) {
+        auto *Ret = llvm::dyn_cast<llvm::ReturnInst>(BB.getTerminator());
+        if (!Ret) continue;
+        llvm::SmallVector<llvm::Value *, 4> objects;
+        llvm::GetUnderlyingObjects(Ret->getReturnValue(), objects, DL);
+        for (llvm::Value *object : objects) {
+          if (llvm::isa<llvm::ConstantPointerNull>(object)) continue;
+          if (!isAllocation(object, TLI) || follow(object, TLI).Escapes)
+            return false;
+        }
+      }
+      return true;
+    }
+
+    // Whether only the current thread may access object V
+    bool isLocalObject(llvm::Value *V, const llvm::TargetLibraryInfo &TLI) {
+      if (auto *A = llvm::dyn_cast<llvm::Argument>(V)) {
+        auto S = Summaries.find(A->getParent());
+        return S != Summaries.end() && S->second.ArgLocal[A->getArgNo()];
+      }
+      if (!llvm::isa<llvm::AllocaInst>(V) && !isAllocation(V, TLI))
+        return false;
+
+      auto cached = Cache.find(V);
+      if (cached != Cache.end()) return cached->second;
+      Flow flow = follow(V, TLI);
+      const bool local = !flow.Escapes && !flow.Returned;
+      Cache[V] = local;
+      return local;
+    }
+  };
+
+} // end EmbedSanitizer
@@ -60,6 +60,52 @@
 // purpose of EmbedSanitizer: race detection for 32-bit ARM.
 namespace EmbedSanitizer {
 
+  /**
+   * Check if the function releases a heap block of unknown size:
+   * free or the unsized operator delete variants.
+   */
+  bool IsFreeFunction(llvm::StringRef name) {
+    return name == "free" ||
+           name == "_ZdlPv" || name == "_ZdaPv";     // delete, delete[]
+  }
+
+  /**
+   * Check if the function is a sized operator delete, which gets
+   * the size of the block as its second argument.
+   */
+  bool IsSizedDeleteFunction(llvm::StringRef name) {
+    return name == "_ZdlPvj" || name == "_ZdaPvj" || // 32-bit
+           name == "_ZdlPvm" || name == "_ZdaPvm";   // 64-bit
+  }
+
+  /**
+   * Insert a call to the runtime callback "callback" of a lock,
+   * condition variable or barrier at the insert point of IRB. The
+   * callbacks of try functions also get the result of the call,
+   * "result", so that they acquire only when the lock was taken.
+   */
+  void InsertSyncCallback(llvm::IRBuilder<> & IRB, llvm::Module * M,
+                          llvm::StringRef callback, llvm::Value * lockAddr,
+                          llvm::Value * result = nullptr) {
+    lockAddr = IRB.CreatePointerCast(lockAddr, IRB.getInt8PtrTy());
+
+    if (!result) {
+      llvm::Function * tsan_callback = checkSanitizerInterfaceFunction(
+          M->getOrInsertFunction(
+              callback, IRB.getVoidTy(),
+              IRB.getInt8PtrTy(), nullptr));
+      IRB.CreateCall(tsan_callback, {lockAddr} );
+      return;
+    }
+
+    llvm::Function * tsan_callback = checkSanitizerInterfaceFunction(
+        M->getOrInsertFunction(
+            callback, IRB.getVoidTy(),
+            IRB.getInt8PtrTy(), IRB.getInt32Ty(), nullptr));
+    IRB.CreateCall(tsan_callback,
+                   {lockAddr, IRB.CreateSExtOrTrunc(result, IRB.getInt32Ty())} );
+  }
+
   /**
    * Check if the call instruction calls one of the
    * synchronization functions (eg. pthread_create,
@@ -136,6 +182,178 @@ namespace EmbedSanitizer {
 
       // insert the callback function
       IRB.CreateCall(tsan_unlock, {lockAddr} );
+    } else if (name == "pthread_mutex_destroy") {
+
+      llvm::Value * lockAddr = CI->getArgOperand(0); // lock pointer
+
+      // Create callback function
+      llvm::Function * tsan_lock_destroy = checkSanitizerInterfaceFunction(
+          M->getOrInsertFunction(
+              "__tsan_thread_lock_destroy",
+              IRB.getVoidTy(),
+              IRB.getInt8PtrTy(), nullptr));
+
+      // insert the callback function
+      IRB.CreateCall(tsan_lock_destroy,
+                     {IRB.CreatePointerCast(lockAddr, IRB.getInt8PtrTy())} );
+    } else if (name == "pthread_mutex_trylock" ||
+               name == "pthread_mutex_timedlock" ||
+               name == "pthread_spin_trylock") {
+
+      // acquire after the call, only if it took the lock
+      IRB.SetInsertPoint(Inst.getNextNode());
+      InsertSyncCallback(IRB, M, "__tsan_thread_trylock",
+                         CI->getArgOperand(0), CI);
+    } else if (name == "pthread_spin_lock") {
+
+      // spin locks synchronize as mutexes
+      IRB.SetInsertPoint(Inst.getNextNode());
+      InsertSyncCallback(IRB, M, "__tsan_thread_lock", CI->getArgOperand(0));
+    } else if (name == "pthread_spin_unlock") {
+
+      InsertSyncCallback(IRB, M, "__tsan_thread_unlock", CI->getArgOperand(0));
+    } else if (name == "pthread_spin_destroy") {
+
+      InsertSyncCallback(IRB, M, "__tsan_thread_lock_destroy",
+                         CI->getArgOperand(0));
+    } else if (name == "pthread_rwlock_rdlock" ||
+               name == "pthread_rwlock_wrlock") {
+
+      // acquire after the call returns with the lock
+      IRB.SetInsertPoint(Inst.getNextNode());
+      InsertSyncCallback(IRB, M, name == "pthread_rwlock_rdlock" ?
+                         "__tsan_rwlock_rdlock" : "__tsan_rwlock_wrlock",
+                         CI->getArgOperand(0));
+    } else if (name == "pthread_rwlock_tryrdlock" ||
+               name == "pthread_rwlock_trywrlock") {
+
+      // acquire after the call, only if it took the lock
+      IRB.SetInsertPoint(Inst.getNextNode());
+      InsertSyncCallback(IRB, M, name == "pthread_rwlock_tryrdlock" ?
+                         "__tsan_rwlock_tryrdlock" : "__tsan_rwlock_trywrlock",
+                         CI->getArgOperand(0), CI);
+    } else if (name == "pthread_rwlock_unlock") {
+
+      // release before the call gives the lock away
+      InsertSyncCallback(IRB, M, "__tsan_rwlock_unlock", CI->getArgOperand(0));
+    } else if (name == "pthread_rwlock_destroy") {
+
+      InsertSyncCallback(IRB, M, "__tsan_rwlock_destroy", CI->getArgOperand(0));
+    } else if (name == "pthread_cond_wait" ||
+               name == "pthread_cond_timedwait") {
+
+      // the wait releases the mutex inside libc and takes it again
+      // before it returns, also when it times out
+      llvm::Value * condAddr =
+          IRB.CreatePointerCast(CI->getArgOperand(0), IRB.getInt8PtrTy());
+      llvm::Value * mutexAddr =
+          IRB.CreatePointerCast(CI->getArgOperand(1), IRB.getInt8PtrTy());
+
+      // Create callback functions
+      llvm::Function * tsan_wait_enter = checkSanitizerInterfaceFunction(
+          M->getOrInsertFunction(
+              "__tsan_cond_wait_enter", IRB.getVoidTy(),
+              IRB.getInt8PtrTy(), IRB.getInt8PtrTy(), nullptr));
+      llvm::Function * tsan_wait = checkSanitizerInterfaceFunction(
+          M->getOrInsertFunction(
+              "__tsan_cond_wait", IRB.getVoidTy(),
+              IRB.getInt8PtrTy(), IRB.getInt8PtrTy(),
+              IRB.getInt32Ty(), nullptr));
+
+      // insert the callback functions around the call
+      IRB.CreateCall(tsan_wait_enter, {condAddr, mutexAddr} );
+      IRB.SetInsertPoint(Inst.getNextNode());
+      IRB.CreateCall(tsan_wait,
+                     {condAddr, mutexAddr,
+                      IRB.CreateSExtOrTrunc(CI, IRB.getInt32Ty())} );
+    } else if (name == "pthread_cond_signal" ||
+               name == "pthread_cond_broadcast") {
+
+      // release before the call wakes up a waiter
+      InsertSyncCallback(IRB, M, "__tsan_cond_signal", CI->getArgOperand(0));
+    } else if (name == "pthread_cond_destroy") {
+
+      InsertSyncCallback(IRB, M, "__tsan_cond_destroy", CI->getArgOperand(0));
+    } else if (name == "pthread_barrier_init") {
+
+      llvm::Value * barrierAddr = CI->getArgOperand(0);
+      llvm::Value * count = CI->getArgOperand(2);
+      IRB.SetInsertPoint(Inst.getNextNode());
+
+      // Create callback function
+      llvm::Function * tsan_barrier_init = checkSanitizerInterfaceFunction(
+          M->getOrInsertFunction(
+              "__tsan_barrier_init", IRB.getVoidTy(),
+              IRB.getInt8PtrTy(), IRB.getInt32Ty(), nullptr));
+
+      // insert the callback function after the call
+      IRB.CreateCall(tsan_barrier_init,
+                     {IRB.CreatePointerCast(barrierAddr, IRB.getInt8PtrTy()),
+                      IRB.CreateZExtOrTrunc(count, IRB.getInt32Ty())} );
+    } else if (name == "pthread_barrier_wait") {
+
+      // arrive before the call blocks, depart after it returns
+      InsertSyncCallback(IRB, M, "__tsan_barrier_wait_enter",
+                         CI->getArgOperand(0));
+      IRB.SetInsertPoint(Inst.getNextNode());
+      InsertSyncCallback(IRB, M, "__tsan_barrier_wait", CI->getArgOperand(0));
+    } else if (name == "pthread_barrier_destroy") {
+
+      InsertSyncCallback(IRB, M, "__tsan_barrier_destroy",
+                         CI->getArgOperand(0));
+    } else if (IsFreeFunction(name) &&
+               (name == "free" || F->isDeclaration())) {
+
+      // pointer to the released block, its size is known to the
+      // runtime only before the block is released. An operator
+      // delete that the module replaces may not use malloc: the
+      // runtime could not ask for the size of its blocks.
+      llvm::Value * blockAddr = CI->getArgOperand(0);
+
+      // Create callback function
+      llvm::Function * tsan_free = checkSanitizerInterfaceFunction(
+          M->getOrInsertFunction(
+              "__tsan_free",
+              IRB.getVoidTy(),
+              IRB.getInt8PtrTy(), nullptr));
+
+      // insert the callback function before the call
+      IRB.CreateCall(tsan_free,
+                     {IRB.CreatePointerCast(blockAddr, IRB.getInt8PtrTy())} );
+    } else if (IsSizedDeleteFunction(name)) {
+
+      llvm::Value * blockAddr = CI->getArgOperand(0);
+      llvm::Value * blockSize = CI->getArgOperand(1);
+      llvm::Type * SizeTy = M->getDataLayout().getIntPtrType(M->getContext());
+
+      // Create callback function
+      llvm::Function * tsan_free_sized = checkSanitizerInterfaceFunction(
+          M->getOrInsertFunction(
+              "__tsan_free_sized",
+              IRB.getVoidTy(),
+              IRB.getInt8PtrTy(), SizeTy, nullptr));
+
+      // insert the callback function before the call
+      IRB.CreateCall(tsan_free_sized,
+                     {IRB.CreatePointerCast(blockAddr, IRB.getInt8PtrTy()),
+                      IRB.CreateZExtOrTrunc(blockSize, SizeTy)} );
+    } else if (name == "munmap") {
+
+      llvm::Value * mapAddr = CI->getArgOperand(0);
+      llvm::Value * mapSize = CI->getArgOperand(1);
+      llvm::Type * SizeTy = M->getDataLayout().getIntPtrType(M->getContext());
+
+      // Create callback function
+      llvm::Function * tsan_munmap = checkSanitizerInterfaceFunction(
+          M->getOrInsertFunction(
+              "__tsan_munmap",
+              IRB.getVoidTy(),
+              IRB.getInt8PtrTy(), SizeTy, nullptr));
+
+      // insert the callback function before the call
+      IRB.CreateCall(tsan_munmap,
+                     {IRB.CreatePointerCast(mapAddr, IRB.getInt8PtrTy()),
+                      IRB.CreateZExtOrTrunc(mapSize, SizeTy)} );
     } // end if
   } // end function
 } // end namespace
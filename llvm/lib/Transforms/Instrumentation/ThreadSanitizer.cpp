@@ -20,15 +20,23 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Transforms/Instrumentation.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/Triple.h"
 #include "llvm/Analysis/CaptureTracking.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/IntrinsicInst.h"
@@ -48,6 +56,7 @@
 #include "llvm/Transforms/Utils/ModuleUtils.h"
 #include "EmbedSanitizerExtension.h"
 #include "EmbedSanitizerDebugInfo.h"
+#include "EmbedSanitizerEscape.h"
 
 using namespace llvm;
 
@@ -69,6 +78,18 @@ static cl::opt<bool>  ClInstrumentAtomics(
 static cl::opt<bool>  ClInstrumentMemIntrinsics(
     "tsan-instrument-memintrinsics", cl::init(true),
     cl::desc("Instrument memintrinsics (memset/memcpy/memmove)"), cl::Hidden);
+static cl::opt<bool>  ClEliminateRedundantChecks(
+    "tsan-eliminate-redundant-checks", cl::init(true),
+    cl::desc("Do not instrument accesses checked by a dominating access "
+             "with no call in between"), cl::Hidden);
+static cl::opt<bool>  ClHoistLoopChecks(
+    "tsan-hoist-loop-checks", cl::init(true),
+    cl::desc("Check the affine accesses of loops with no calls once, "
+             "as a range, before the loop"), cl::Hidden);
+static cl::opt<bool>  ClSkipThreadLocal(
+    "tsan-skip-thread-local", cl::init(true),
+    cl::desc("Do not instrument accesses to memory that never escapes "
+             "to another thread"), cl::Hidden);
 
 STATISTIC(NumInstrumentedReads, "Number of instrumented reads");
 STATISTIC(NumInstrumentedWrites, "Number of instrumented writes");
@@ -81,6 +102,15 @@ STATISTIC(NumOmittedReadsFromConstantGlobals,
           "Number of reads from constant globals");
 STATISTIC(NumOmittedReadsFromVtable, "Number of vtable reads");
 STATISTIC(NumOmittedNonCaptured, "Number of accesses ignored due to capturing");
+STATISTIC(NumOmittedThreadLocal,
+          "Number of accesses ignored due to thread-local memory");
+STATISTIC(NumOmittedDominatedReads,
+          "Number of reads ignored due to dominating checks");
+STATISTIC(NumOmittedDominatedWrites,
+          "Number of writes ignored due to dominating checks");
+STATISTIC(NumHoistedReads, "Number of reads checked as a range before a loop");
+STATISTIC(NumHoistedWrites,
+          "Number of writes checked as a range before a loop");
 
 static const char *const kTsanModuleCtorName = "tsan.module_ctor";
 static const char *const kTsanInitName = "__tsan_init";
@@ -103,7 +133,12 @@ struct ThreadSanitizer : public FunctionPass {
   bool instrumentMemIntrinsic(Instruction *I);
   void chooseInstructionsToInstrument(SmallVectorImpl<Instruction *> &Local,
                                       SmallVectorImpl<Instruction *> &All,
-                                      const DataLayout &DL);
+                                      const DataLayout &DL,
+                                      const TargetLibraryInfo &TLI);
+  void removeDominatedChecks(Function &F, SmallVectorImpl<Instruction *> &All,
+                             const DataLayout &DL);
+  bool hoistLoopChecks(SmallVectorImpl<Instruction *> &All,
+                       const DataLayout &DL);
   bool addrPointsToConstantData(Value *Addr);
   int getMemoryAccessFuncIndex(Value *Addr, const DataLayout &DL);
   void InsertRuntimeIgnores(Function &F);
@@ -122,6 +157,8 @@ struct ThreadSanitizer : public FunctionPass {
   Function *TsanWrite[kNumberOfAccessSizes];
   Function *TsanUnalignedRead[kNumberOfAccessSizes];
   Function *TsanUnalignedWrite[kNumberOfAccessSizes];
+  Function *TsanReadRange;
+  Function *TsanWriteRange;
   Function *TsanAtomicLoad[kNumberOfAccessSizes];
   Function *TsanAtomicStore[kNumberOfAccessSizes];
   Function *TsanAtomicRMW[AtomicRMWInst::LAST_BINOP + 1][kNumberOfAccessSizes];
@@ -132,6 +169,10 @@ struct ThreadSanitizer : public FunctionPass {
   Function *TsanVptrLoad;
   Function *MemmoveFn, *MemcpyFn, *MemsetFn;
   Function *TsanCtorFunction;
+  // Site descriptors and strings of the current module
+  EmbedSanitizer::SiteTable Sites;
+  // Memory of the current module that never escapes its thread
+  EmbedSanitizer::ThreadEscapeAnalysis Escapes;
 };
 }  // namespace
 
@@ -141,6 +182,9 @@ INITIALIZE_PASS_BEGIN(
     "EmbedSanitizer: detects data races.",
     false, false)
 INITIALIZE_PASS_DEPENDENCY(TargetLibraryInfoWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(DominatorTreeWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(LoopInfoWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(ScalarEvolutionWrapperPass)
 INITIALIZE_PASS_END(
     ThreadSanitizer, "tsan",
     "EmbedSanitizer: detects data races.",
@@ -150,6 +194,9 @@ StringRef ThreadSanitizer::getPassName() const { return "EmbedSanitizer"; }
 
 void ThreadSanitizer::getAnalysisUsage(AnalysisUsage &AU) const {
   AU.addRequired<TargetLibraryInfoWrapperPass>();
+  AU.addRequired<DominatorTreeWrapperPass>();
+  AU.addRequired<LoopInfoWrapperPass>();
+  AU.addRequired<ScalarEvolutionWrapperPass>();
 }
 
 FunctionPass *llvm::createThreadSanitizerPass() {
@@ -180,24 +227,24 @@ void ThreadSanitizer::initializeCallbacks(Module &M) {
     SmallString<32> ReadName("__tsan_read" + ByteSizeStr);
     TsanRead[i] = checkSanitizerInterfaceFunction(M.getOrInsertFunction(
         ReadName, Attr, IRB.getVoidTy(), IRB.getInt8PtrTy(),
-        IRB.getInt8Ty(), IRB.getInt8PtrTy(), IRB.getInt8PtrTy(), nullptr));
+        IRB.getInt8PtrTy(), nullptr));
 
     SmallString<32> WriteName("__tsan_write" + ByteSizeStr);
     TsanWrite[i] = checkSanitizerInterfaceFunction(M.getOrInsertFunction(
         WriteName, Attr, IRB.getVoidTy(), IRB.getInt8PtrTy(),
-        IRB.getInt8Ty(), IRB.getInt8PtrTy(), IRB.getInt8PtrTy(), nullptr));
+        IRB.getInt8PtrTy(), nullptr));
 
     SmallString<64> UnalignedReadName("__tsan_unaligned_read" + ByteSizeStr);
     TsanUnalignedRead[i] =
         checkSanitizerInterfaceFunction(M.getOrInsertFunction(
             UnalignedReadName, Attr, IRB.getVoidTy(), IRB.getInt8PtrTy(),
-            IRB.getInt8Ty(), IRB.getInt8PtrTy(), IRB.getInt8PtrTy(), nullptr));
+            IRB.getInt8PtrTy(), nullptr));
 
     SmallString<64> UnalignedWriteName("__tsan_unaligned_write" + ByteSizeStr);
     TsanUnalignedWrite[i] =
         checkSanitizerInterfaceFunction(M.getOrInsertFunction(
             UnalignedWriteName, Attr, IRB.getVoidTy(), IRB.getInt8PtrTy(),
-            IRB.getInt8Ty(), IRB.getInt8PtrTy(), IRB.getInt8PtrTy(), nullptr));
+            IRB.getInt8PtrTy(), nullptr));
 
     Type *Ty = Type::getIntNTy(M.getContext(), BitSize);
     Type *PtrTy = Ty->getPointerTo();
@@ -239,13 +286,19 @@ void ThreadSanitizer::initializeCallbacks(Module &M) {
     TsanAtomicCAS[i] = checkSanitizerInterfaceFunction(M.getOrInsertFunction(
         AtomicCASName, Attr, Ty, PtrTy, Ty, Ty, OrdTy, OrdTy, nullptr));
   }
+  TsanReadRange = checkSanitizerInterfaceFunction(M.getOrInsertFunction(
+      "__tsan_read_range", Attr, IRB.getVoidTy(), IRB.getInt8PtrTy(),
+      IntptrTy, IRB.getInt8PtrTy(), nullptr));
+  TsanWriteRange = checkSanitizerInterfaceFunction(M.getOrInsertFunction(
+      "__tsan_write_range", Attr, IRB.getVoidTy(), IRB.getInt8PtrTy(),
+      IntptrTy, IRB.getInt8PtrTy(), nullptr));
   TsanVptrUpdate = checkSanitizerInterfaceFunction(
       M.getOrInsertFunction("__tsan_vptr_update", Attr, IRB.getVoidTy(),
                             IRB.getInt8PtrTy(), IRB.getInt8PtrTy(),
-                            IRB.getInt8Ty(), IRB.getInt8PtrTy(), IRB.getInt8PtrTy(), nullptr));
+                            IRB.getInt8PtrTy(), nullptr));
   TsanVptrLoad = checkSanitizerInterfaceFunction(M.getOrInsertFunction(
       "__tsan_vptr_read", Attr, IRB.getVoidTy(), IRB.getInt8PtrTy(),
-                          IRB.getInt8Ty(), IRB.getInt8PtrTy(), IRB.getInt8PtrTy(), nullptr));
+                          IRB.getInt8PtrTy(), nullptr));
   TsanAtomicThreadFence = checkSanitizerInterfaceFunction(M.getOrInsertFunction(
       "__tsan_atomic_thread_fence", Attr, IRB.getVoidTy(), OrdTy, nullptr));
   TsanAtomicSignalFence = checkSanitizerInterfaceFunction(M.getOrInsertFunction(
@@ -264,6 +317,7 @@ void ThreadSanitizer::initializeCallbacks(Module &M) {
 
 bool ThreadSanitizer::doInitialization(Module &M) {
   const DataLayout &DL = M.getDataLayout();
+  Sites.reset();
   IntptrTy = DL.getIntPtrType(M.getContext());
   std::tie(TsanCtorFunction, std::ignore) = createSanitizerCtorAndInitFunctions(
       M, kTsanModuleCtorName, kTsanInitName, /*InitArgTypes=*/{},
@@ -271,6 +325,11 @@ bool ThreadSanitizer::doInitialization(Module &M) {
 
   appendToGlobalCtors(M, TsanCtorFunction, 0);
 
+  if (ClSkipThreadLocal) {
+    TargetLibraryInfoImpl TLII(Triple(M.getTargetTriple()));
+    Escapes.analyze(M, TargetLibraryInfo(TLII));
+  }
+
   return true;
 }
 
@@ -337,6 +396,7 @@ bool ThreadSanitizer::addrPointsToConstantData(Value *Addr) {
 // Currently handled:
 //  - read-before-write (within same BB, no calls between)
 //  - not captured variables
+//  - memory that never escapes its thread (see ThreadEscapeAnalysis)
 //
 // We do not handle some of the patterns that should not survive
 // after the classic compiler optimizations.
@@ -347,7 +407,7 @@ bool ThreadSanitizer::addrPointsToConstantData(Value *Addr) {
 // 'All' is a vector of insns that will be instrumented.
 void ThreadSanitizer::chooseInstructionsToInstrument(
     SmallVectorImpl<Instruction *> &Local, SmallVectorImpl<Instruction *> &All,
-    const DataLayout &DL) {
+    const DataLayout &DL, const TargetLibraryInfo &TLI) {
   SmallSet<Value*, 8> WriteTargets;
   // Iterate from the end.
   for (Instruction *I : reverse(Local)) {
@@ -382,11 +442,219 @@ void ThreadSanitizer::chooseInstructionsToInstrument(
       NumOmittedNonCaptured++;
       continue;
     }
+    if (ClSkipThreadLocal && Escapes.isThreadLocal(Addr, DL, TLI)) {
+      // Only this thread ever has the address of the memory accessed:
+      // e.g. a heap buffer of the function, passed only to callees
+      // that do not keep it.
+      NumOmittedThreadLocal++;
+      continue;
+    }
     All.push_back(I);
   }
   Local.clear();
 }
 
+// Whether I may synchronize, or start a new epoch of the thread in
+// the runtime: calls other than debug info and lifetime markers, and
+// atomic instructions.
+static bool mayStartNewEpoch(Instruction &I) {
+  if (isa<DbgInfoIntrinsic>(I))
+    return false;
+  if (IntrinsicInst *II = dyn_cast<IntrinsicInst>(&I))
+    if (II->getIntrinsicID() == Intrinsic::lifetime_start ||
+        II->getIntrinsicID() == Intrinsic::lifetime_end)
+      return false;
+  return isa<CallInst>(I) || isa<InvokeInst>(I) || I.isAtomic();
+}
+
+// Drops the accesses in 'All' that are checked by a dominating access
+// to the same address, of the same size or more, that writes or is a
+// read like them, with no call or atomic instruction on any path in
+// between. Both checks then run in the same epoch of the thread in
+// the runtime, where FastTrack finds nothing new at the second one.
+//
+// The dominator tree is walked depth first, as in EarlyCSE: a check
+// is only available below its block, and only in its "generation".
+// A call starts a new generation, and so does a block with more than
+// one predecessor, since the paths to it may bypass the checks above.
+void ThreadSanitizer::removeDominatedChecks(
+    Function &F, SmallVectorImpl<Instruction *> &All, const DataLayout &DL) {
+  struct Check {
+    unsigned Generation;
+    uint64_t Size;
+    bool IsWrite;
+  };
+  DenseMap<Value *, Check> Available;
+  SmallVector<std::pair<Value *, Check>, 16> Undo; // checks replaced
+  SmallPtrSet<Instruction *, 16> Instrumented(All.begin(), All.end());
+  SmallPtrSet<Instruction *, 16> Dominated;
+  unsigned CurrentGeneration = 0;
+
+  // Visits block BB entered in generation Gen, returns the generation
+  // at its end
+  auto visit = [&](BasicBlock *BB, unsigned Gen) {
+    if (!BB->getSinglePredecessor())
+      Gen = ++CurrentGeneration;
+    for (Instruction &I : *BB) {
+      if (mayStartNewEpoch(I)) {
+        Gen = ++CurrentGeneration;
+        continue;
+      }
+      if (!Instrumented.count(&I))
+        continue;
+      const bool IsWrite = isa<StoreInst>(I);
+      Value *Addr = IsWrite ? cast<StoreInst>(I).getPointerOperand()
+                            : cast<LoadInst>(I).getPointerOperand();
+      const uint64_t Size = DL.getTypeStoreSize(
+          cast<PointerType>(Addr->getType())->getElementType());
+
+      auto Found = Available.find(Addr);
+      const bool Known = Found != Available.end() &&
+                         Found->second.Generation == Gen;
+      if (Known && Found->second.Size >= Size &&
+          (Found->second.IsWrite || !IsWrite)) {
+        Dominated.insert(&I);
+        if (IsWrite) NumOmittedDominatedWrites++;
+        else         NumOmittedDominatedReads++;
+        continue;
+      }
+      if (Known && !IsWrite && Found->second.IsWrite)
+        continue; // a larger read does not replace a write
+      Check Old = Found != Available.end() ? Found->second
+                                           : Check{0, 0, false};
+      Undo.push_back({Addr, Old});
+      Available[Addr] = {Gen, Size, IsWrite};
+    }
+    return Gen;
+  };
+
+  struct Frame {
+    DomTreeNode *Node;
+    DomTreeNode::iterator Child;
+    unsigned Generation; // at the end of the block of Node
+    size_t UndoMark;
+  };
+  DominatorTree &DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+  DomTreeNode *Root = DT.getRootNode();
+  SmallVector<Frame, 32> Stack;
+  size_t Mark = Undo.size();
+  Stack.push_back({Root, Root->begin(), visit(Root->getBlock(), 0), Mark});
+
+  while (!Stack.empty()) {
+    Frame &Top = Stack.back();
+    if (Top.Child != Top.Node->end()) {
+      DomTreeNode *Next = *Top.Child++;
+      const unsigned Gen = Top.Generation;
+      Mark = Undo.size();
+      Stack.push_back({Next, Next->begin(), visit(Next->getBlock(), Gen), Mark});
+      continue;
+    }
+    // leaving the subtree: its checks are not available to siblings
+    while (Undo.size() > Top.UndoMark) {
+      auto &Entry = Undo.back();
+      if (Entry.second.Generation == 0) Available.erase(Entry.first);
+      else Available[Entry.first] = Entry.second;
+      Undo.pop_back();
+    }
+    Stack.pop_back();
+  }
+
+  if (!Dominated.empty())
+    All.erase(std::remove_if(All.begin(), All.end(), [&](Instruction *I) {
+      return Dominated.count(I) != 0;
+    }), All.end());
+}
+
+// Whether no instruction of loop L may start a new epoch
+static bool isEpochFree(Loop *L) {
+  for (BasicBlock *BB : L->blocks())
+    for (Instruction &I : *BB)
+      if (mayStartNewEpoch(I))
+        return false;
+  return true;
+}
+
+// Replaces the checks in 'All' of accesses that walk memory in a loop
+// by one range check before the loop. ScalarEvolution must prove that
+// the address is {Start,+,Step} in the loop, with Step no larger than
+// the access, so that the accesses of all iterations cover a range
+// with no gaps. The loop must have no call or atomic instruction: all
+// its iterations run in one epoch of the thread, where FastTrack finds
+// nothing new after the first access to a location. The access must
+// run in every iteration of a loop with a single exit, so that the
+// range holds only bytes the loop accesses.
+bool ThreadSanitizer::hoistLoopChecks(SmallVectorImpl<Instruction *> &All,
+                                      const DataLayout &DL) {
+  LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+  ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+  DominatorTree &DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+  SCEVExpander Expander(SE, DL, "tsan");
+  SmallDenseMap<Loop *, bool, 8> EpochFree;
+  SmallPtrSet<Instruction *, 16> Hoisted;
+
+  for (Instruction *I : All) {
+    Loop *L = LI.getLoopFor(I->getParent());
+    if (!L || isVtableAccess(I))
+      continue;
+    BasicBlock *Preheader = L->getLoopPreheader();
+    BasicBlock *Exiting = L->getExitingBlock();
+    if (!Preheader || !Exiting || !DT.dominates(I->getParent(), Exiting))
+      continue;
+    auto Found = EpochFree.find(L);
+    if (Found == EpochFree.end())
+      Found = EpochFree.insert({L, isEpochFree(L)}).first;
+    if (!Found->second)
+      continue;
+
+    const bool IsWrite = isa<StoreInst>(*I);
+    Value *Addr = IsWrite ? cast<StoreInst>(I)->getPointerOperand()
+                          : cast<LoadInst>(I)->getPointerOperand();
+    if (Addr->isSwiftError())
+      continue;
+    const uint64_t Size = DL.getTypeStoreSize(
+        cast<PointerType>(Addr->getType())->getElementType());
+    const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(Addr));
+    if (!AR || AR->getLoop() != L || !AR->isAffine())
+      continue;
+    const SCEVConstant *Step =
+        dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE));
+    const SCEV *Count = SE.getBackedgeTakenCount(L);
+    if (!Step || isa<SCEVCouldNotCompute>(Count))
+      continue;
+    const APInt &StepValue = Step->getAPInt();
+    if (StepValue == 0 || StepValue.abs().ugt(Size))
+      continue;
+
+    // The loop accesses Start, Start + Step, ..., Start + Count * Step
+    const SCEV *Last = AR->evaluateAtIteration(Count, SE);
+    const SCEV *Base = StepValue.isNegative() ? Last : AR->getStart();
+    const SCEV *Span = SE.getMulExpr(
+        SE.getTruncateOrZeroExtend(Count, IntptrTy),
+        SE.getConstant(IntptrTy, StepValue.abs().getZExtValue()));
+    const SCEV *Len = SE.getAddExpr(Span, SE.getConstant(IntptrTy, Size));
+    if (!isSafeToExpand(Base, SE) || !isSafeToExpand(Len, SE))
+      continue;
+
+    Instruction *InsertPt = Preheader->getTerminator();
+    IRBuilder<> IRB(InsertPt);
+    Value *BaseValue =
+        Expander.expandCodeFor(Base, IRB.getInt8PtrTy(), InsertPt);
+    Value *LenValue = Expander.expandCodeFor(Len, IntptrTy, InsertPt);
+    IRB.CreateCall(IsWrite ? TsanWriteRange : TsanReadRange,
+                   {BaseValue, LenValue, Sites.get(Addr, I, DL)});
+    Hoisted.insert(I);
+    if (IsWrite) NumHoistedWrites++;
+    else         NumHoistedReads++;
+  }
+
+  if (Hoisted.empty())
+    return false;
+  All.erase(std::remove_if(All.begin(), All.end(), [&](Instruction *I) {
+    return Hoisted.count(I) != 0;
+  }), All.end());
+  return true;
+}
+
 static bool isAtomic(Instruction *I) {
   if (LoadInst *LI = dyn_cast<LoadInst>(I))
     return LI->isAtomic() && LI->getSynchScope() == CrossThread;
@@ -426,6 +694,7 @@ bool ThreadSanitizer::runOnFunction(Function &F) {
   const DataLayout &DL = F.getParent()->getDataLayout();
   const TargetLibraryInfo *TLI =
       &getAnalysis<TargetLibraryInfoWrapperPass>().getTLI();
+  Escapes.startFunction();
 
   // Traverse all instructions, collect loads/stores/returns, check for calls.
   for (auto &BB : F) {
@@ -448,17 +717,23 @@ bool ThreadSanitizer::runOnFunction(Function &F) {
         }
         HasCalls = true;
         chooseInstructionsToInstrument(LocalLoadsAndStores, AllLoadsAndStores,
-                                       DL);
+                                       DL, *TLI);
       }
     }
-    chooseInstructionsToInstrument(LocalLoadsAndStores, AllLoadsAndStores, DL);
+    chooseInstructionsToInstrument(LocalLoadsAndStores, AllLoadsAndStores, DL,
+                                   *TLI);
   }
 
   // We have collected all loads and stores.
+  if (ClEliminateRedundantChecks)
+    removeDominatedChecks(F, AllLoadsAndStores, DL);
+
   // FIXME: many of these accesses do not need to be checked for races
   // (e.g. variables that do not escape, etc).
 
   // Instrument memory accesses only if we want to report bugs in the function.
+  if (ClInstrumentMemoryAccesses && SanitizeFunction && ClHoistLoopChecks)
+    Res |= hoistLoopChecks(AllLoadsAndStores, DL);
   if (ClInstrumentMemoryAccesses && SanitizeFunction)
     for (auto Inst : AllLoadsAndStores) {
       Res |= instrumentLoadOrStore(Inst, DL);
@@ -492,7 +767,7 @@ bool ThreadSanitizer::runOnFunction(Function &F) {
 
     //IRB.CreateCall(TsanFuncEntry, ReturnAddress);
     // Save function name as string into function body
-    Value* func_name = EmbedSanitizer::getFuncName(F);
+    Value* func_name = Sites.getFuncName(F);
     IRB.CreateCall(TsanFuncEntry, {IRB.CreatePointerCast(func_name, IRB.getInt8PtrTy())});
 
     EscapeEnumerator EE(F, "tsan_cleanup", ClHandleCxxExceptions);
@@ -546,20 +821,14 @@ bool ThreadSanitizer::instrumentLoadOrStore(Instruction *I,
     IRB.CreateCall(TsanVptrUpdate,
                    {IRB.CreatePointerCast(Addr, IRB.getInt8PtrTy()),
                     IRB.CreatePointerCast(StoredValue, IRB.getInt8PtrTy()),
-                    IRB.CreateIntCast(EmbedSanitizer::getLineNumber(I), IRB.getInt8Ty(), false),
-                    EmbedSanitizer::getObjectName(Addr, I, DL),
-                    EmbedSanitizer::getFileName(I)
-                  });
+                    Sites.get(Addr, I, DL)});
     NumInstrumentedVtableWrites++;
     return true;
   }
   if (!IsWrite && isVtableAccess(I)) {
     IRB.CreateCall(TsanVptrLoad,
                    {IRB.CreatePointerCast(Addr, IRB.getInt8PtrTy()),
-                    IRB.CreateIntCast(EmbedSanitizer::getLineNumber(I), IRB.getInt8Ty(), false),
-                    EmbedSanitizer::getObjectName(Addr, I, DL),
-                    EmbedSanitizer::getFileName(I)
-                  });
+                    Sites.get(Addr, I, DL)});
     NumInstrumentedVtableReads++;
     return true;
   }
@@ -573,11 +842,10 @@ bool ThreadSanitizer::instrumentLoadOrStore(Instruction *I,
     OnAccessFunc = IsWrite ? TsanWrite[Idx] : TsanRead[Idx];
   else
     OnAccessFunc = IsWrite ? TsanUnalignedWrite[Idx] : TsanUnalignedRead[Idx];
+  // the address and the site ID: two argument registers on ARM EABI
   IRB.CreateCall(OnAccessFunc, {
         IRB.CreatePointerCast(Addr, IRB.getInt8PtrTy()),
-        IRB.CreateIntCast(EmbedSanitizer::getLineNumber(I), IRB.getInt8Ty(), false),
-        EmbedSanitizer::getObjectName(Addr, I, DL),
-        EmbedSanitizer::getFileName(I)
+        Sites.get(Addr, I, DL)
       });
 
   if (IsWrite) NumInstrumentedWrites++;
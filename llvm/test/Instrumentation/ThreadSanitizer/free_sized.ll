@@ -0,0 +1,39 @@
+; Sized deletes pass their size to the runtime, deletes the module
+; replaces are not asked for the size of their blocks
+; RUN: opt < %s -tsan -S | FileCheck %s
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+declare void @free(i8*)
+declare void @_ZdaPv(i8*)
+declare void @_ZdlPvm(i8*, i64)
+declare void @_ZdaPvm(i8*, i64)
+
+; operator delete(void*) of a custom allocator
+define void @_ZdlPv(i8* %p) {
+entry:
+  ret void
+}
+
+define void @release(i8* %a, i8* %b, i8* %c, i8* %d, i8* %e) sanitize_thread {
+entry:
+  call void @free(i8* %a)
+  call void @_ZdaPv(i8* %b)
+  call void @_ZdlPvm(i8* %c, i64 24)
+  call void @_ZdaPvm(i8* %d, i64 48)
+  call void @_ZdlPv(i8* %e)
+  ret void
+}
+
+; CHECK-LABEL: @release
+; CHECK: call void @__tsan_free(i8* %a)
+; CHECK-NEXT: call void @free(i8* %a)
+; CHECK: call void @__tsan_free(i8* %b)
+; CHECK-NEXT: call void @_ZdaPv(i8* %b)
+; CHECK: call void @__tsan_free_sized(i8* %c, i64 24)
+; CHECK-NEXT: call void @_ZdlPvm(i8* %c, i64 24)
+; CHECK: call void @__tsan_free_sized(i8* %d, i64 48)
+; CHECK-NEXT: call void @_ZdaPvm(i8* %d, i64 48)
+; CHECK-NOT: __tsan_free
+; CHECK: call void @_ZdlPv(i8* %e)
@@ -0,0 +1,39 @@
+; Accesses to heap memory that never escapes its thread are not instrumented
+; RUN: opt < %s -tsan -S | FileCheck %s
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+@Shared = global i32* null, align 8
+
+declare noalias i8* @malloc(i64)
+declare void @free(i8*)
+
+; malloc, use and free in one block: __tsan_free does not make it escape
+define i32 @local_buffer() sanitize_thread {
+entry:
+  %raw = call noalias i8* @malloc(i64 16)
+  %p = bitcast i8* %raw to i32*
+  store i32 1, i32* %p, align 4
+  %v = load i32, i32* %p, align 4
+  call void @free(i8* %raw)
+  ret i32 %v
+}
+; CHECK-LABEL: define i32 @local_buffer(
+; CHECK-NOT: call void @__tsan_{{read|write}}4
+; CHECK: call void @__tsan_free(
+; CHECK-NOT: call void @__tsan_{{read|write}}4
+; CHECK: ret i32
+
+; the same buffer published through a global is instrumented
+define i32 @shared_buffer() sanitize_thread {
+entry:
+  %raw = call noalias i8* @malloc(i64 16)
+  %p = bitcast i8* %raw to i32*
+  store i32* %p, i32** @Shared, align 8
+  store i32 1, i32* %p, align 4
+  %v = load i32, i32* %p, align 4
+  ret i32 %v
+}
+; CHECK-LABEL: define i32 @shared_buffer(
+; CHECK: call void @__tsan_write4(
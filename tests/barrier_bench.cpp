@@ -0,0 +1,55 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Microbenchmark of barrier waits with 4 to 256 threads. Each
+// generation is one n-way join: every thread joins its clock at
+// arrival and the joined clock at departure, so a wait costs one
+// clock of n entries twice, and a generation n such waits. The
+// threads are simulated in turn, as in sync_bench. Not a test: run
+// it by hand.
+//
+////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+
+#include "etsan/fasttrack.h"
+
+static const int kWaits = 400000;
+
+// ns per wait, with all threads waiting at one barrier
+static double nsPerWait(int threads) {
+  std::vector<ThreadState> T(threads);
+  for (int t = 0; t < threads; t++) {
+    T[t].tid = t;
+    newVectorClock(T[t].C, threads);
+    T[t].C[t] = EPOCH(t, 1);
+    T[t].updateEpoch();
+  }
+  BarrierState barrier;
+  barrier.count = threads;
+
+  const int generations = kWaits / threads;
+  auto start = std::chrono::steady_clock::now();
+  for (int g = 0; g < generations; g++) {
+    for (auto & t : T) ft_arrive(t, barrier);
+    for (auto & t : T) ft_depart(t, barrier);
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+    std::chrono::steady_clock::now() - start;
+  return elapsed.count() / (generations * threads);
+}
+
+int main() {
+  printf("%8s %14s %18s\n", "threads", "wait ns", "wait ns / thread");
+
+  for (int threads : {4, 16, 64, 256}) {
+    double wait = nsPerWait(threads);
+    printf("%8d %14.1f %18.2f\n", threads, wait, wait / threads);
+  }
+  return 0;
+}
@@ -0,0 +1,109 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the bounded memory mode (-DETSAN_MAX_METADATA_MB=1).
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+#include "etsan/fasttrack.h"
+
+class BoundedMemoryTestFixture : public ::testing::Test {
+protected:
+
+  const unsigned long budget = ETSAN_MAX_METADATA_MB * 1024UL * 1024UL;
+
+  // application bytes covered by one shadow page
+  const uintptr_t page_span = VS.Shadow.kCellsPerPage * GRANULE;
+
+  Address address(int page) {
+    return (Address)(0x10000000 + page * page_span);
+  }
+
+  BoundedMemoryTestFixture() {
+    TS.clear();
+    VS.Shadow.clear();
+    VS.evicted = 0;
+  }
+};
+
+TEST_F(BoundedMemoryTestFixture, staysWithinBudget) {
+  for (int page = 0; page < 20; page++) {
+    getVarState(address(page), true);
+    EXPECT_LE(VS.Shadow.residentBytes() + MetaAlloc.bytesInUse(), budget);
+  }
+  EXPECT_EQ(20U, VS.Shadow.pages());
+  EXPECT_LT(0U, VS.evicted.load());
+}
+
+TEST_F(BoundedMemoryTestFixture, evictsColdPagesFirst) {
+  for (int page = 0; page < 20; page++) {
+    getVarState(address(page), true);
+    getVarState(address(0), true); // keeps page 0 hot
+  }
+  EXPECT_TRUE(VS.Shadow.find(address(0))->Used);
+  EXPECT_FALSE(VS.Shadow.find(address(1))->Used);
+}
+
+TEST_F(BoundedMemoryTestFixture, countsRetouchedAddresses) {
+  for (int page = 0; page < 20; page++) {
+    getVarState(address(page), true);
+  }
+  ASSERT_FALSE(VS.Shadow.find(address(0))->Used); // evicted
+  EXPECT_EQ(0U, VS.Shadow.retouched());
+
+  getVarState(address(0), false);
+  getVarState(address(0), false); // counted once
+  EXPECT_EQ(1U, VS.Shadow.retouched());
+  EXPECT_TRUE(VS.Shadow.find(address(0))->Used);
+}
+
+TEST_F(BoundedMemoryTestFixture, evictedStatesStartAfresh) {
+  ThreadState thread1, thread2;
+  thread1.tid = 0;
+  thread2.tid = 1;
+  for (ThreadState * t : {&thread1, &thread2}) {
+    newVectorClock(t->C, 2);
+    t->C[t->tid] = EPOCH(t->tid, 1);
+    t->updateEpoch();
+  }
+
+  EXPECT_FALSE(ft_write(address(0), 4, thread1));
+  for (int page = 1; page < 20; page++) {
+    getVarState(address(page), true);
+  }
+
+  // the race is missed: the price of the budget
+  EXPECT_FALSE(ft_write(address(0), 4, thread2));
+}
+
+TEST_F(BoundedMemoryTestFixture, stateEvictedBeforeSlowPathIsUsedAgain) {
+  VarState & x = getVarState(address(0), false);
+  ThreadState & t = getThreadState();
+  for (int page = 1; page < 20; page++) {
+    getVarState(address(page), true); // evicts page 0
+  }
+  ASSERT_FALSE(x.Used);
+
+  EXPECT_FALSE(ft_write(x, t)); // as after touchVarState
+  EXPECT_TRUE(x.Used);
+  EXPECT_EQ(t.epoch, x.W);
+}
+
+TEST_F(BoundedMemoryTestFixture, resetWaitsForLockedStates) {
+  VarState & x = getVarState(address(0), true);
+  x.Guard.lock();
+  std::thread freer([&] { reclaimVarStates(address(0), GRANULE); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_TRUE(x.Used); // not destroyed under its holder
+  x.Guard.unlock();
+  freer.join();
+  EXPECT_FALSE(x.Used);
+}
@@ -10,6 +10,7 @@
 
 #include <gtest/gtest.h>
 
+#include <atomic>
 #include <thread>
 
 #include "etsan/defs.h"
@@ -20,7 +21,7 @@ protected:
   const int num_threads = 5;
 
   DefsTestFixture() {
-    TS.C.clear();
+    TS.clear();
     VS.Vstates.clear();
     LS.L.clear();
   }
@@ -94,6 +95,57 @@ TEST_F(DefsTestFixture, checkGetStateNewThread) {
   }
 }
 
+TEST_F(DefsTestFixture, checkGetStateTidsStartAtZero) {
+  auto& thread1_state = getState(1);
+  auto& thread2_state = getState(10);
+
+  EXPECT_EQ(0, thread1_state.tid);
+  EXPECT_EQ(1, thread2_state.tid);
+  EXPECT_EQ(2, TS.Slots);
+  EXPECT_EQ(thread2_state.epoch, thread2_state.C.at(thread2_state.tid));
+}
+
+TEST_F(DefsTestFixture, checkJoinedThreadSlotIsReused) {
+  auto& parent_state = getState(1);
+  auto& child_state = getState(2);
+  const auto child_tid = child_state.tid;
+
+  // the parent joins the child
+  child_state.increment();
+  parent_state.C[child_tid] = child_state.epoch;
+  const auto last_epoch = child_state.epoch;
+  retireThreadState(2, parent_state);
+  EXPECT_EQ(1, TS.C.size());
+
+  auto& new_state = getState(3);
+  EXPECT_EQ(child_tid, new_state.tid);
+  EXPECT_EQ(last_epoch + 1, new_state.epoch);
+  EXPECT_EQ(new_state.epoch, new_state.C.at(new_state.tid));
+  EXPECT_EQ(2, TS.Slots);
+  EXPECT_EQ(2, parent_state.C.size());
+}
+
+TEST_F(DefsTestFixture, checkSlotNotReusedBeforeAllThreadsCaughtUp) {
+  auto& parent_state = getState(1);
+  auto& other_state = getState(2);
+  auto& child_state = getState(3);
+  const auto child_tid = child_state.tid;
+
+  // only the parent knows the last epoch of the child
+  child_state.increment();
+  parent_state.C[child_tid] = child_state.epoch;
+  retireThreadState(3, parent_state);
+
+  auto& new_state = getState(4);
+  EXPECT_NE(child_tid, new_state.tid);
+  EXPECT_EQ(4, TS.Slots);
+
+  // once every live thread knows it, the slot is reused
+  other_state.C[child_tid] = parent_state.C[child_tid];
+  new_state.C[child_tid] = parent_state.C[child_tid];
+  EXPECT_EQ(child_tid, getState(5).tid);
+}
+
 TEST_F(DefsTestFixture, checkGetStateExistingThread) {
   auto& thread_state = getThreadState();
   auto this_thread_id = TS.C.begin()->first;
@@ -103,6 +155,60 @@ TEST_F(DefsTestFixture, checkGetStateExistingThread) {
   EXPECT_EQ(&thread_state, &another_state);
 }
 
+TEST_F(DefsTestFixture, checkGetThreadStateIsCachedPerThread) {
+  auto& thread_state = getThreadState();
+  EXPECT_EQ(&thread_state, CurrentThreadState);
+  EXPECT_EQ(&thread_state, &getThreadState());
+
+  ThreadState* other_state = nullptr;
+  std::thread other([&]() { other_state = &getThreadState(); });
+  other.join();
+
+  EXPECT_EQ(2, TS.C.size());
+  EXPECT_NE(&thread_state, other_state);
+  EXPECT_EQ(&thread_state, &getThreadState());
+}
+
+TEST_F(DefsTestFixture, checkReusedThreadIdGetsFreshState) {
+  auto& parent_state = getThreadState();
+
+  ThreadID old_id = 0;
+  unsigned long old_uid = 0;
+  std::thread old_thread([&]() {
+    old_id = (ThreadID)pthread_self();
+    old_uid = getThreadState().uid;
+  });
+  old_thread.join();
+  EXPECT_TRUE(TS.C.at(old_id).exited);
+
+  // glibc hands the id of a joined thread to the next thread, which
+  // may use it before the join callback of the old one runs
+  ThreadID new_id = 0;
+  unsigned long new_uid = 0;
+  std::atomic<int> step{0};
+  std::thread new_thread([&]() {
+    new_id = (ThreadID)pthread_self();
+    auto& new_state = getThreadState();
+    new_uid = new_state.uid;
+    step = 1;
+    while (step != 2) std::this_thread::yield();
+    new_state.increment(); // still its own state
+    EXPECT_EQ(&new_state, &TS.C.at(new_id));
+  });
+  while (step != 1) std::this_thread::yield();
+
+  EXPECT_NE(old_uid, new_uid);
+  if (new_id == old_id) {
+    EXPECT_EQ(old_uid, TS.Exited.at(old_id).uid);
+  }
+
+  retireThreadState(old_id, parent_state);
+  EXPECT_EQ(0, TS.Exited.size());
+  EXPECT_EQ(new_uid, TS.C.at(new_id).uid);
+  step = 2;
+  new_thread.join();
+}
+
 TEST_F(DefsTestFixture, checkGetVarStateWhenDoesNotExistIsRead) {
   Address address = (void *)(0x001);
   auto isWrite = false;
@@ -212,3 +318,26 @@ TEST_F(DefsTestFixture, checkGetExistingLockState) {
     EXPECT_EQ(i << 24, lock_state.L.at(i)); // 0 clock values
   }
 }
+
+TEST_F(DefsTestFixture, checkReclaimLockState) {
+  Address lock = (void *)(0x0123);
+  NumThreads = num_threads;
+  getLockState(lock);
+  getLockState((void *)(0x0456));
+
+  const auto reclaimed = ReclaimedBytes.load();
+  reclaimLockState(lock);
+  EXPECT_EQ(1, LS.L.size());
+  EXPECT_LT(reclaimed, ReclaimedBytes.load());
+}
+
+TEST_F(DefsTestFixture, checkReclaimVarStates) {
+  getVarState((void *)(0x100), true);
+  getVarState((void *)(0x104), true);
+  getVarState((void *)(0x108), true);
+  EXPECT_EQ(3, VS.Vstates.size());
+
+  reclaimVarStates((void *)(0x100), 8);
+  EXPECT_EQ(1, VS.Vstates.size());
+  EXPECT_EQ(1, VS.Vstates.count((void *)(0x108)));
+}
@@ -109,3 +109,20 @@ TEST(FasttrackReadTestFixture, ftReadCheckExclusive) {
   EXPECT_EQ(thread_state.epoch, variable_state.R);
 }
 
+TEST(FasttrackReadTestFixture, ftSameEpochReadSkipsLockedCheck) {
+  VS.reads = 0;
+
+  VarState variable_state;
+  ThreadState thread_state;
+  thread_state.tid = 2;
+  thread_state.epoch = (2 << 24) + 7;
+
+  variable_state.R = thread_state.epoch;
+  EXPECT_TRUE(ft_same_epoch_read(variable_state, thread_state));
+
+  // a write in the same epoch does not make a read redundant
+  variable_state.R = (2 << 24) + 6;
+  variable_state.W = thread_state.epoch;
+  EXPECT_FALSE(ft_same_epoch_read(variable_state, thread_state));
+  EXPECT_EQ(0, VS.reads);
+}
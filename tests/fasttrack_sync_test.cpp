@@ -106,3 +106,295 @@ TEST(FasttrackSyncTestFixture, ftJoinMaxClocksForParentThread) {
     EXPECT_EQ((i << 24) + i, parent_state.C.at(i)) << "value of i = " << i;
   }
 }
+
+#ifndef ETSAN_TREE_CLOCK // vector clocks only
+TEST(FasttrackSyncTestFixture, releaseSharesClockUntilNextJoin) {
+  ThreadState releaser;
+  releaser.tid = 0;
+  newVectorClock(releaser.C, 2);
+  releaser.C[0] = EPOCH(0, 1);
+  releaser.updateEpoch();
+
+  ThreadState acquirer;
+  acquirer.tid = 1;
+  newVectorClock(acquirer.C, 2);
+  acquirer.C[1] = EPOCH(1, 1);
+  acquirer.updateEpoch();
+
+  LockState lock_state;
+  newVectorClock(lock_state.L, 2);
+
+  ft_release(releaser, lock_state);
+  EXPECT_TRUE(releaser.C.shared());
+  EXPECT_EQ(EPOCH(0, 2), releaser.epoch);
+
+  // the acquirer knows the release, not the later epoch of the releaser
+  ft_acquire(acquirer, lock_state);
+  EXPECT_EQ(EPOCH(0, 1), acquirer.C[0]);
+
+  // a join of the releaser gives it its own clock back
+  LockState other_lock;
+  newVectorClock(other_lock.L, 2);
+  ft_acquire(releaser, other_lock);
+  EXPECT_FALSE(releaser.C.shared());
+  EXPECT_EQ(EPOCH(0, 1), lock_state.L[0]);
+}
+#endif
+
+// Two threads with their own entries only, and a fresh lock
+class SameOwnerTestFixture : public ::testing::Test {
+protected:
+
+  ThreadState owner;
+  ThreadState other;
+  LockState lock_state;
+
+  SameOwnerTestFixture() {
+    owner.tid = 0;
+    other.tid = 1;
+    for (ThreadState * t : {&owner, &other}) {
+      newVectorClock(t->C, 2);
+      t->C[t->tid] = EPOCH(t->tid, 1);
+      t->updateEpoch();
+    }
+    newVectorClock(lock_state.L, 2);
+  }
+};
+
+TEST_F(SameOwnerTestFixture, reacquireByLastReleaserJoinsNothing) {
+  ft_release(owner, lock_state);
+  const auto joins = owner.joins;
+
+  ft_acquire(owner, lock_state);
+  EXPECT_EQ(joins, owner.joins);
+  EXPECT_EQ(EPOCH(0, 2), owner.epoch);
+
+  ft_acquire(other, lock_state);
+  EXPECT_EQ(joins + 1, other.joins);
+}
+
+TEST_F(SameOwnerTestFixture, rereleaseAdvancesEntryOfOwner) {
+  for (int i = 0; i < 3; i++) {
+    ft_acquire(owner, lock_state);
+    ft_release(owner, lock_state);
+  }
+  EXPECT_EQ(EPOCH(0, 3), lock_state.L[0]);
+  EXPECT_EQ(0U, CLOCK(lock_state.L[1]));
+
+  ft_acquire(other, lock_state);
+  EXPECT_EQ(EPOCH(0, 3), other.C[0]);
+}
+
+TEST_F(SameOwnerTestFixture, rereleaseAfterJoinCopiesClock) {
+  ft_release(owner, lock_state);
+
+  // the owner learns the other thread through a second lock
+  LockState other_lock;
+  newVectorClock(other_lock.L, 2);
+  ft_release(other, other_lock);
+  ft_acquire(owner, other_lock);
+
+  ft_acquire(owner, lock_state);
+  ft_release(owner, lock_state);
+  EXPECT_EQ(EPOCH(1, 1), lock_state.L[1]);
+  EXPECT_EQ(EPOCH(0, 2), lock_state.L[0]);
+}
+
+TEST_F(SameOwnerTestFixture, releaseByAnotherThreadEndsOwnership) {
+  ft_release(owner, lock_state);
+  ft_acquire(other, lock_state);
+  ft_release(other, lock_state);
+
+  // the owner must join the release of the other thread
+  ft_acquire(owner, lock_state);
+  EXPECT_EQ(EPOCH(1, 1), owner.C[1]);
+}
+
+// Three threads with their own entries only, and a fresh rwlock
+class RWLockTestFixture : public ::testing::Test {
+protected:
+
+  ThreadState threads[3];
+  RWLockState lock_state;
+
+  RWLockTestFixture() {
+    for (unsigned tid = 0; tid < 3; tid++) {
+      ThreadState & t = threads[tid];
+      t.tid = tid;
+      newVectorClock(t.C, 3);
+      t.C[tid] = EPOCH(tid, 1);
+      t.updateEpoch();
+    }
+    newVectorClock(lock_state.W, 3);
+  }
+};
+
+TEST_F(RWLockTestFixture, readersDoNotOrderEachOther) {
+  ft_acquire(threads[0], lock_state, false);
+  ft_release(threads[0], lock_state);
+
+  ft_acquire(threads[1], lock_state, false);
+  EXPECT_EQ(0U, CLOCK(threads[1].C[0]));
+}
+
+TEST_F(RWLockTestFixture, writerJoinsAllReaderReleases) {
+  for (int tid : {0, 1}) {
+    ft_acquire(threads[tid], lock_state, false);
+    ft_release(threads[tid], lock_state);
+  }
+
+  ft_acquire(threads[2], lock_state, true);
+  EXPECT_EQ(EPOCH(0, 1), threads[2].C[0]);
+  EXPECT_EQ(EPOCH(1, 1), threads[2].C[1]);
+}
+
+TEST_F(RWLockTestFixture, readerJoinsLastWriterRelease) {
+  ft_acquire(threads[0], lock_state, true);
+  ft_release(threads[0], lock_state);
+  EXPECT_FALSE(lock_state.writing);
+
+  ft_acquire(threads[1], lock_state, false);
+  EXPECT_EQ(EPOCH(0, 1), threads[1].C[0]);
+}
+
+TEST_F(RWLockTestFixture, writerReleaseCoversEarlierReaders) {
+  ft_acquire(threads[0], lock_state, false);
+  ft_release(threads[0], lock_state);
+  ft_acquire(threads[1], lock_state, true);
+  ft_release(threads[1], lock_state);
+  EXPECT_TRUE(lock_state.R.empty());
+
+  // the reader release is known through the writer
+  ft_acquire(threads[2], lock_state, false);
+  EXPECT_EQ(EPOCH(0, 1), threads[2].C[0]);
+  EXPECT_EQ(EPOCH(1, 1), threads[2].C[1]);
+}
+
+// The same three threads, and a fresh condition variable
+class CondVarTestFixture : public RWLockTestFixture {
+protected:
+
+  CondState cond_state;
+};
+
+TEST_F(CondVarTestFixture, waiterJoinsAllSignals) {
+  ft_signal(threads[0], cond_state);
+  ft_signal(threads[1], cond_state);
+  EXPECT_EQ(EPOCH(0, 2), threads[0].epoch);
+
+  ft_wait(threads[2], cond_state);
+  EXPECT_EQ(EPOCH(0, 1), threads[2].C[0]);
+  EXPECT_EQ(EPOCH(1, 1), threads[2].C[1]);
+  EXPECT_EQ(EPOCH(2, 1), threads[2].epoch);
+}
+
+TEST_F(CondVarTestFixture, waitWithoutSignalJoinsNothing) {
+  const auto joins = threads[2].joins;
+
+  ft_wait(threads[2], cond_state);
+  EXPECT_EQ(joins, threads[2].joins);
+  EXPECT_EQ(0U, CLOCK(threads[2].C[0]));
+}
+
+// The same three threads, waiting at a barrier for all three
+class BarrierTestFixture : public RWLockTestFixture {
+protected:
+
+  BarrierState barrier_state;
+
+  BarrierTestFixture() { barrier_state.count = 3; }
+};
+
+TEST_F(BarrierTestFixture, departuresJoinWholeGeneration) {
+  for (auto & t : threads) ft_arrive(t, barrier_state);
+  EXPECT_TRUE(barrier_state.Arrived.empty());
+
+  for (auto & t : threads) {
+    ft_depart(t, barrier_state);
+    for (unsigned u = 0; u < 3; u++) {
+      if (u != t.tid) {
+        EXPECT_EQ(EPOCH(u, 1), t.C[u]);
+      }
+    }
+    EXPECT_EQ(EPOCH(t.tid, 2), t.epoch);
+  }
+}
+
+TEST_F(BarrierTestFixture, nextGenerationStartsAfresh) {
+  for (auto & t : threads) ft_arrive(t, barrier_state);
+  for (auto & t : threads) ft_depart(t, barrier_state);
+
+  // thread 0 arrives early at the next generation: no one learns it
+  ft_arrive(threads[0], barrier_state);
+  EXPECT_EQ(1U, barrier_state.arrived);
+  EXPECT_EQ(EPOCH(0, 1), barrier_state.Departed[0]);
+}
+
+// The same three threads, and the sync clock of an atomic location
+class AtomicTestFixture : public RWLockTestFixture {
+protected:
+
+  LockState sync;
+
+  AtomicTestFixture() { newVectorClock(sync.L, 3); }
+
+  void atomic(ThreadState & t, int order, bool rmw = false) {
+    ft_atomic(t, sync, rmw, [=]() { return order; });
+  }
+};
+
+TEST_F(AtomicTestFixture, acquireLoadJoinsReleaseStore) {
+  atomic(threads[0], kAtomicRelease);
+  EXPECT_EQ(EPOCH(0, 2), threads[0].epoch);
+
+  atomic(threads[1], kAtomicAcquire);
+  EXPECT_EQ(EPOCH(0, 1), threads[1].C[0]);
+}
+
+TEST_F(AtomicTestFixture, relaxedOperationsDoNoClockWork) {
+  atomic(threads[0], kAtomicRelaxed);
+  EXPECT_EQ(EPOCH(0, 1), threads[0].epoch);
+  EXPECT_EQ(0U, CLOCK(sync.L[0]));
+
+  atomic(threads[0], kAtomicRelease);
+  atomic(threads[1], kAtomicRelaxed);
+  EXPECT_EQ(0U, CLOCK(threads[1].C[0]));
+}
+
+TEST_F(AtomicTestFixture, releaseStoreReplacesClock) {
+  atomic(threads[0], kAtomicRelease);
+  atomic(threads[1], kAtomicRelease);
+
+  atomic(threads[2], kAtomicAcquire);
+  EXPECT_EQ(0U, CLOCK(threads[2].C[0]));
+  EXPECT_EQ(EPOCH(1, 1), threads[2].C[1]);
+}
+
+TEST_F(AtomicTestFixture, readModifyWriteKeepsEarlierReleases) {
+  atomic(threads[0], kAtomicRelease);
+  atomic(threads[1], kAtomicRelease, true);
+  atomic(threads[1], kAtomicRelease, true); // not advanced in place
+
+  atomic(threads[2], kAtomicAcquire);
+  EXPECT_EQ(EPOCH(0, 1), threads[2].C[0]);
+  EXPECT_EQ(EPOCH(1, 2), threads[2].C[1]);
+}
+
+TEST_F(AtomicTestFixture, releaseFenceMakesLaterRelaxedWritesRelease) {
+  ft_fence(threads[0], kAtomicRelease);
+  EXPECT_EQ(EPOCH(0, 2), threads[0].epoch);
+
+  atomic(threads[0], kAtomicWrite);
+  atomic(threads[1], kAtomicAcquire);
+  EXPECT_EQ(EPOCH(0, 1), threads[1].C[0]);
+}
+
+TEST_F(AtomicTestFixture, acquireFenceJoinsEarlierRelaxedReads) {
+  atomic(threads[0], kAtomicRelease);
+  atomic(threads[1], kAtomicRead);
+  EXPECT_EQ(0U, CLOCK(threads[1].C[0]));
+
+  ft_fence(threads[1], kAtomicAcquire);
+  EXPECT_EQ(EPOCH(0, 1), threads[1].C[0]);
+  EXPECT_TRUE(threads[1].fenceAcquire.empty());
+}
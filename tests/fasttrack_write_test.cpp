@@ -10,6 +10,9 @@
 
 #include <gtest/gtest.h>
 
+#include <thread>
+#include <vector>
+
 #include "etsan/fasttrack.h"
 
 TEST(FasttrackWriteTestFixture, ftWriteCheckWritesCountIncremented) {
@@ -109,3 +112,55 @@ TEST(FasttrackWriteTestFixture, ftWriteCheckExclusive) {
   EXPECT_EQ(race_found, ft_write(variable_state, thread_state));
   EXPECT_EQ(thread_state.epoch, variable_state.W);
 }
+
+TEST(FasttrackWriteTestFixture, ftWriteUnrelatedVariablesInParallel) {
+  VS.reads = 0;
+  VS.writes = 0;
+  constexpr int num_threads = 4;
+  constexpr int num_writes = 10000;
+
+  std::vector<VarState> variable_states(num_threads);
+  std::vector<ThreadState> thread_states(num_threads);
+  std::vector<std::thread> threads;
+
+  for (int i = 0; i < num_threads; i++) {
+    thread_states[i].tid = i;
+    newVectorClock(thread_states[i].C, num_threads);
+    thread_states[i].increment();
+    variable_states[i].W = thread_states[i].epoch;
+    variable_states[i].R = thread_states[i].epoch;
+  }
+
+  for (int i = 0; i < num_threads; i++) {
+    threads.push_back(std::thread([&, i]() {
+      for (int w = 0; w < num_writes; w++) {
+        EXPECT_FALSE(ft_write(variable_states[i], thread_states[i]));
+      }
+    }));
+  }
+
+  for (auto & thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(num_threads * num_writes, VS.writes);
+  EXPECT_EQ(0, VS.reads);
+}
+
+TEST(FasttrackWriteTestFixture, ftSameEpochWriteSkipsLockedCheck) {
+  VS.writes = 0;
+
+  VarState variable_state;
+  ThreadState thread_state;
+  thread_state.tid = 2;
+  thread_state.epoch = (2 << 24) + 7;
+
+  variable_state.W = thread_state.epoch;
+  EXPECT_TRUE(ft_same_epoch_write(variable_state, thread_state));
+
+  // a read in the same epoch does not make a write redundant
+  variable_state.W = (2 << 24) + 6;
+  variable_state.R = thread_state.epoch;
+  EXPECT_FALSE(ft_same_epoch_write(variable_state, thread_state));
+  EXPECT_EQ(0, VS.writes);
+}
@@ -0,0 +1,88 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the concurrent table of lock states.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "etsan/defs.h"
+
+static void initState(LockState & lock) {
+  newVectorClock(lock.L, 2);
+}
+
+static Address lockAt(std::size_t i) {
+  return (Address)(0x1000 + 8 * i);
+}
+
+TEST(LockTableTest, sameAddressSameState) {
+  LockTable<LockState> table;
+  LockState & state = table.get(lockAt(0), initState);
+
+  EXPECT_EQ(&state, &table.get(lockAt(0), initState));
+  EXPECT_EQ(&state, table.find(lockAt(0)));
+  EXPECT_EQ(nullptr, table.find(lockAt(1)));
+  EXPECT_EQ(2U, state.L.size());
+  EXPECT_EQ(1U, table.size());
+}
+
+TEST(LockTableTest, growsPastFirstSegment) {
+  LockTable<LockState> table;
+  const std::size_t locks = 4 * LockTable<LockState>::kFirstSegmentSlots;
+  std::vector<LockState *> states;
+  for (std::size_t i = 0; i < locks; i++) {
+    states.push_back(&table.get(lockAt(i), initState));
+  }
+
+  EXPECT_EQ(locks, table.size());
+  for (std::size_t i = 0; i < locks; i++) {
+    ASSERT_EQ(states[i], table.find(lockAt(i))) << "lock " << i;
+  }
+}
+
+TEST(LockTableTest, destroyedLockStartsAfresh) {
+  LockTable<LockState> table;
+  table.get(lockAt(0), initState).L[0] = EPOCH(0, 5);
+  const auto slot_bytes = table.slotBytes();
+
+  int done = 0;
+  EXPECT_TRUE(table.erase(lockAt(0), [&](LockState &) { done++; }));
+  EXPECT_FALSE(table.erase(lockAt(0), [&](LockState &) { done++; }));
+  EXPECT_EQ(1, done);
+  EXPECT_EQ(0U, table.size());
+  EXPECT_EQ(nullptr, table.find(lockAt(0)));
+
+  // a new lock at the same address reuses the slot
+  EXPECT_EQ(EPOCH(0, 0), table.get(lockAt(0), initState).L.at(0));
+  EXPECT_EQ(slot_bytes, table.slotBytes());
+}
+
+TEST(LockTableTest, concurrentThreadsAgreeOnStates) {
+  LockTable<LockState> table;
+  const int num_threads = 4;
+  const std::size_t locks = 3 * LockTable<LockState>::kFirstSegmentSlots;
+  std::vector<std::vector<LockState *>> seen(num_threads);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t] {
+      for (std::size_t i = 0; i < locks; i++) {
+        seen[t].push_back(&table.get(lockAt(i), initState));
+      }
+    });
+  }
+  for (auto & thread : threads) thread.join();
+
+  EXPECT_EQ(locks, table.size());
+  for (int t = 1; t < num_threads; t++) {
+    EXPECT_EQ(seen[0], seen[t]);
+  }
+}
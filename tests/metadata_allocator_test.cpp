@@ -0,0 +1,65 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the metadata slab allocator.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include "etsan/defs.h"
+
+TEST(MetadataAllocatorTest, freedBlockIsReusedBySameSizeClass) {
+  MetadataAllocator allocator;
+  void * block = allocator.allocate(24);
+  allocator.deallocate(block, 24);
+
+  EXPECT_EQ(block, allocator.allocate(32)); // same 32 byte class
+  EXPECT_NE(block, allocator.allocate(32));
+}
+
+TEST(MetadataAllocatorTest, sizeClassesUseSeparateChunks) {
+  MetadataAllocator allocator;
+  char * small = (char *)allocator.allocate(8);
+  char * big = (char *)allocator.allocate(1024);
+
+  EXPECT_EQ(2 * MetadataAllocator::kChunkSize, allocator.bytesMapped());
+  EXPECT_TRUE(big < small || big >= small + MetadataAllocator::kChunkSize);
+}
+
+TEST(MetadataAllocatorTest, countsBytesInUse) {
+  MetadataAllocator allocator;
+  void * block1 = allocator.allocate(5);    // 8 bytes
+  void * block2 = allocator.allocate(100);  // 128 bytes
+  EXPECT_EQ(136U, allocator.bytesInUse());
+
+  allocator.deallocate(block1, 5);
+  allocator.deallocate(block2, 100);
+  EXPECT_EQ(0U, allocator.bytesInUse());
+}
+
+TEST(MetadataAllocatorTest, largeBlocksAreMappedAlone) {
+  MetadataAllocator allocator;
+  const size_t bytes = 100 * 1024;
+  char * block = (char *)allocator.allocate(bytes);
+  block[0] = block[bytes - 1] = 1; // writable
+
+  EXPECT_GE(allocator.bytesMapped(), bytes);
+  allocator.deallocate(block, bytes);
+  EXPECT_EQ(0U, allocator.bytesMapped());
+  EXPECT_EQ(0U, allocator.bytesInUse());
+}
+
+TEST(MetadataAllocatorTest, vectorClocksAllocateFromMetadata) {
+  const auto before = MetaAlloc.bytesInUse();
+  {
+    VectorClock VC;
+    newVectorClock(VC, 16);
+    // entries and the reference count of the buffer
+    EXPECT_LE(before + 16 * sizeof(Epoch), MetaAlloc.bytesInUse());
+  }
+  EXPECT_EQ(before, MetaAlloc.bytesInUse());
+}
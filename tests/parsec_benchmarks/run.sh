@@ -55,6 +55,9 @@ reportBenchStats() {
 
   threads=`egrep "Threads: " stats.txt`
   echo " - # of $threads" >> $home/BenchmarkReports.txt
+
+  metadata=`egrep "Metadata: " stats.txt`
+  echo " - $metadata" >> $home/BenchmarkReports.txt
 }
 
 input_set=""
@@ -0,0 +1,232 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the shadow memory of variable states.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include "etsan/fasttrack.h"
+
+class ShadowMemoryTestFixture : public ::testing::Test {
+protected:
+
+  ShadowMemory<VarState> shadow;
+
+  ShadowMemoryTestFixture() {
+    TS.clear();
+    VS.Shadow.clear();
+  }
+
+  ~ShadowMemoryTestFixture() {
+    shadow.clear();
+  }
+};
+
+TEST_F(ShadowMemoryTestFixture, sameAddressSameCell) {
+  int variable = 0;
+  VarState & cell = shadow.get(&variable);
+
+  EXPECT_EQ(&cell, &shadow.get(&variable));
+  EXPECT_EQ(&cell, shadow.find(&variable));
+  EXPECT_EQ(1U, shadow.pages());
+}
+
+TEST_F(ShadowMemoryTestFixture, neighbourAddressesDifferentCells) {
+  char buffer[2] = {0, 0};
+  EXPECT_NE(&shadow.get(&buffer[0]), &shadow.get(&buffer[1]));
+}
+
+TEST_F(ShadowMemoryTestFixture, findDoesNotMapPages) {
+  Address address = (void *)(0x1000);
+
+  EXPECT_EQ(nullptr, shadow.find(address));
+  EXPECT_EQ(0U, shadow.pages());
+}
+
+TEST_F(ShadowMemoryTestFixture, pagesMappedOnDemand) {
+  const auto page_size = ShadowMemory<VarState>::kCellsPerPage;
+  Address first = (void *)(page_size - 1);
+  Address second = (void *)(page_size);
+
+  shadow.get(first);
+  EXPECT_EQ(1U, shadow.pages());
+  EXPECT_EQ(nullptr, shadow.find(second));
+
+  shadow.get(second);
+  EXPECT_EQ(2U, shadow.pages());
+}
+
+TEST_F(ShadowMemoryTestFixture, newCellsAreUnused) {
+  Address address = (void *)(0x02);
+  const auto & cell = shadow.get(address);
+
+  EXPECT_FALSE(cell.Used);
+  EXPECT_FALSE(cell.Racy);
+  EXPECT_EQ(0U, cell.Rvc.size());
+}
+
+TEST_F(ShadowMemoryTestFixture, clearUnmapsPages) {
+  shadow.get((void *)(0x02));
+  shadow.clear();
+
+  EXPECT_EQ(0U, shadow.pages());
+  EXPECT_EQ(nullptr, shadow.find((void *)(0x02)));
+}
+
+TEST_F(ShadowMemoryTestFixture, forEachVisitsMappedCells) {
+  shadow.get((void *)(0x02)).Racy = true;
+
+  std::size_t cells = 0;
+  int races = 0;
+  shadow.forEach([&](VarState & x) {
+    cells++;
+    if (x.Racy) races++;
+  });
+
+  const std::size_t page_cells = ShadowMemory<VarState>::kCellsPerPage;
+  EXPECT_EQ(page_cells, cells);
+  EXPECT_EQ(1, races);
+}
+
+TEST_F(ShadowMemoryTestFixture, getVarStateInitializesOnFirstRead) {
+  int variable = 0;
+  const auto & variable_state = getVarState(&variable, false);
+  const auto & thread_state = getThreadState();
+
+  EXPECT_TRUE(variable_state.Used);
+  EXPECT_EQ(thread_state.tid << 24, variable_state.W);
+  EXPECT_EQ(thread_state.epoch, variable_state.R);
+}
+
+TEST_F(ShadowMemoryTestFixture, getVarStateKeepsExistingState) {
+  int variable = 0;
+  auto & variable_state = getVarState(&variable, true);
+  variable_state.W = 42;
+
+  EXPECT_EQ(&variable_state, &getVarState(&variable, false));
+  EXPECT_EQ(42, variable_state.W);
+}
+
+// Two threads with no happens-before relation between them
+class ByteAccessTestFixture : public ShadowMemoryTestFixture {
+protected:
+
+  ThreadState thread1;
+  ThreadState thread2;
+  alignas(16) char buffer[32] = {0};
+
+  ByteAccessTestFixture() {
+    thread1.tid = 0;
+    thread2.tid = 1;
+    for (ThreadState * t : {&thread1, &thread2}) {
+      newVectorClock(t->C, 2);
+      t->C[t->tid] = EPOCH(t->tid, 1);
+      t->updateEpoch();
+    }
+  }
+};
+
+TEST_F(ByteAccessTestFixture, wordWriteAndByteReadInsideMeet) {
+  EXPECT_FALSE(ft_write(&buffer[0], 8, thread1));
+  EXPECT_TRUE(ft_read(&buffer[4], 1, thread2));
+}
+
+TEST_F(ByteAccessTestFixture, neighbourBytesDoNotRace) {
+  EXPECT_FALSE(ft_write(&buffer[0], 1, thread1));
+  EXPECT_FALSE(ft_write(&buffer[1], 1, thread2));
+  EXPECT_FALSE(ft_write(&buffer[2], 2, thread2));
+  EXPECT_TRUE(ft_write(&buffer[0], 4, thread2));
+}
+
+TEST_F(ByteAccessTestFixture, alignedWordsAreNotSplit) {
+  EXPECT_FALSE(ft_write(&buffer[0], 16, thread1));
+
+  for (int i = 0; i < 16; i += GRANULE) {
+    VarState & word = findVarState(&buffer[i]);
+    EXPECT_TRUE(word.Used);
+    EXPECT_EQ(nullptr, word.Bytes.load());
+  }
+  EXPECT_FALSE(findVarState(&buffer[16]).Used);
+}
+
+TEST_F(ByteAccessTestFixture, splitKeepsStateOfWord) {
+  EXPECT_FALSE(ft_write(&buffer[0], 4, thread1));
+  EXPECT_FALSE(ft_read(&buffer[1], 1, thread1)); // splits the word
+
+  VarState * bytes = findVarState(&buffer[0]).Bytes.load();
+  ASSERT_NE(nullptr, bytes);
+  for (int i = 0; i < GRANULE; i++) {
+    EXPECT_EQ(thread1.epoch, bytes[i].W);
+  }
+  EXPECT_TRUE(ft_read(&buffer[3], 1, thread2));
+}
+
+TEST_F(ByteAccessTestFixture, unalignedAccessCoversBothWords) {
+  EXPECT_FALSE(ft_write(&buffer[6], 4, thread1)); // bytes 6 ... 9
+  EXPECT_FALSE(ft_read(&buffer[5], 1, thread2));
+  EXPECT_FALSE(ft_read(&buffer[10], 1, thread2));
+  EXPECT_TRUE(ft_read(&buffer[8], 4, thread2));
+}
+
+TEST_F(ShadowMemoryTestFixture, resetFreshensCellsInRange) {
+  const std::size_t page_cells = ShadowMemory<VarState>::kCellsPerPage;
+  char * base = (char *)(4 * page_cells);
+  shadow.get(base + 1).Racy = true;
+  shadow.get(base + page_cells + 1).Used = true; // whole page below
+  shadow.get(base + 2 * page_cells).Used = true; // past the range
+
+  int visited = 0;
+  auto released = shadow.reset(base + 1, base + 2 * page_cells,
+                               [&](VarState &) { visited++; });
+
+  EXPECT_EQ(page_cells * sizeof(VarState), released);
+  EXPECT_EQ(2 * page_cells - 1, (std::size_t)visited);
+  EXPECT_FALSE(shadow.find(base + 1)->Racy);
+  EXPECT_FALSE(shadow.find(base + page_cells + 1)->Used);
+  EXPECT_TRUE(shadow.find(base + 2 * page_cells)->Used);
+}
+
+TEST_F(ByteAccessTestFixture, reclaimedMemoryStartsAfresh) {
+  EXPECT_FALSE(ft_write(&buffer[0], 8, thread1));
+  EXPECT_FALSE(ft_write(&buffer[9], 1, thread1));
+
+  const auto reclaimed = ReclaimedBytes.load();
+  reclaimVarStates(&buffer[0], 16); // freed, then reused by thread2
+
+  EXPECT_FALSE(ft_write(&buffer[0], 8, thread2));
+  EXPECT_FALSE(ft_write(&buffer[9], 1, thread2));
+  EXPECT_LT(reclaimed, ReclaimedBytes.load()); // byte states of word 8
+}
+
+TEST_F(ShadowMemoryTestFixture, getRangeVisitsCellsAcrossPages) {
+  const std::size_t page_cells = ShadowMemory<VarState>::kCellsPerPage;
+  char * base = (char *)(8 * page_cells);
+
+  std::size_t visited = 0;
+  shadow.getRange(base + page_cells - 2, base + page_cells + 3,
+                  [&](VarState & x) { x.Racy = true; visited++; });
+
+  EXPECT_EQ(5U, visited);
+  EXPECT_EQ(2U, shadow.pages());
+  EXPECT_TRUE(shadow.find(base + page_cells - 2)->Racy);
+  EXPECT_TRUE(shadow.find(base + page_cells + 2)->Racy);
+  EXPECT_FALSE(shadow.find(base + page_cells + 3)->Racy);
+}
+
+TEST_F(ByteAccessTestFixture, rangeCoversEveryWordOfIt) {
+  EXPECT_FALSE(ft_access_range(&buffer[0], 32, thread1, true));
+  EXPECT_FALSE(ft_access_range(&buffer[0], 32, thread1, false));
+  EXPECT_TRUE(ft_read(&buffer[20], 4, thread2));
+}
+
+TEST_F(ByteAccessTestFixture, rangeChecksPartialWordsByBytes) {
+  EXPECT_FALSE(ft_access_range(&buffer[3], 10, thread1, true)); // 3 ... 12
+  EXPECT_FALSE(ft_write(&buffer[2], 1, thread2));
+  EXPECT_FALSE(ft_write(&buffer[13], 1, thread2));
+  EXPECT_TRUE(ft_access_range(&buffer[12], 4, thread2, false));
+}
@@ -0,0 +1,68 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Microbenchmark of lock acquire/release with 4 to 256 threads,
+// built twice: with vector clocks (sync_bench) and with tree
+// clocks (sync_tree_bench). The threads are simulated in turn,
+// so only the cost of the clocks is measured. Not a test: run it
+// by hand.
+//
+////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+
+#include "etsan/fasttrack.h"
+
+static const int kPairs = 400000;
+
+// ns per acquire/release pair. Thread t takes lock lockOf(t, i)
+// in its i-th critical section.
+template <typename LockOf>
+static double nsPerPair(int threads, int locks, LockOf lockOf) {
+  std::vector<ThreadState> T(threads);
+  std::vector<LockState> L(locks);
+  for (int t = 0; t < threads; t++) {
+    T[t].tid = t;
+    newVectorClock(T[t].C, threads);
+    T[t].C[t] = EPOCH(t, 1);
+    T[t].updateEpoch();
+  }
+  for (auto & lock : L) newVectorClock(lock.L, threads);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kPairs; i++) {
+    const int t = i % threads;
+    LockState & lock = L[lockOf(t, i / threads)];
+    ft_acquire(T[t], lock);
+    ft_release(T[t], lock);
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+    std::chrono::steady_clock::now() - start;
+  return elapsed.count() / kPairs;
+}
+
+int main() {
+  printf("%8s %14s %14s %14s\n", "threads", "affine ns", "pairs ns",
+         "global ns");
+
+  for (int threads : {4, 16, 64, 256}) {
+    // mostly own lock, every 16th section a lock shared by all
+    double affine = nsPerPair(threads, threads + 1, [=](int t, int i) {
+      return i % 16 ? t : threads;
+    });
+    // a lock per pair of threads
+    double pairs = nsPerPair(threads, threads / 2, [](int t, int) {
+      return t / 2;
+    });
+    // a single lock
+    double global = nsPerPair(threads, 1, [](int, int) { return 0; });
+
+    printf("%8d %14.1f %14.1f %14.1f\n", threads, affine, pairs, global);
+  }
+  return 0;
+}
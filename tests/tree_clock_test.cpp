@@ -0,0 +1,137 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for tree clocks (-DETSAN_TREE_CLOCK).
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include "etsan/fasttrack.h"
+
+static_assert(std::is_same<ThreadClock, TreeClock<Epoch, CLOCK_MASK>>::value,
+              "built without ETSAN_TREE_CLOCK");
+
+// Threads and locks whose clocks are checked against plain vectors
+class TreeClockTestFixture : public ::testing::Test {
+protected:
+
+  static constexpr int num_threads = 8;
+  static constexpr int num_locks = 4;
+
+  ThreadState threads[num_threads];
+  LockState locks[num_locks];
+  std::vector<std::vector<Epoch>> thread_ref, lock_ref;
+
+  TreeClockTestFixture() {
+    for (int t = 0; t < num_threads; t++) {
+      threads[t].tid = t;
+      newVectorClock(threads[t].C, num_threads);
+      threads[t].C[t] = EPOCH(t, 1);
+      threads[t].updateEpoch();
+
+      thread_ref.push_back(std::vector<Epoch>(num_threads));
+      for (int u = 0; u < num_threads; u++) thread_ref[t][u] = EPOCH(u, u == t);
+    }
+    for (int m = 0; m < num_locks; m++) {
+      newVectorClock(locks[m].L, num_threads);
+      lock_ref.push_back(std::vector<Epoch>(num_threads));
+      for (int u = 0; u < num_threads; u++) lock_ref[m][u] = EPOCH(u, 0);
+    }
+  }
+
+  void acquire(int t, int m) {
+    ft_acquire(threads[t], locks[m]);
+    join(thread_ref[t], lock_ref[m]);
+  }
+
+  void release(int t, int m) {
+    ft_release(threads[t], locks[m]);
+    lock_ref[m] = thread_ref[t];
+    thread_ref[t][t]++;
+  }
+
+  void fork(int t, int u) {
+    ft_fork(threads[t], threads[u]);
+    join(thread_ref[u], thread_ref[t]);
+    thread_ref[t][t]++;
+  }
+
+  static void join(std::vector<Epoch> & c1, const std::vector<Epoch> & c2) {
+    for (std::size_t i = 0; i < c1.size(); i++) c1[i] = std::max(c1[i], c2[i]);
+  }
+
+  void expectSameClocks() {
+    for (int t = 0; t < num_threads; t++) {
+      for (int u = 0; u < num_threads; u++) {
+        const ThreadClock & C = threads[t].C;
+        ASSERT_EQ(thread_ref[t][u], C[u]) << "thread " << t << ", entry " << u;
+      }
+      ASSERT_EQ(thread_ref[t][t], threads[t].epoch);
+    }
+    for (int m = 0; m < num_locks; m++) {
+      for (int u = 0; u < num_threads; u++) {
+        const LockClock & L = locks[m].L;
+        ASSERT_EQ(lock_ref[m][u], L[u]) << "lock " << m << ", entry " << u;
+      }
+    }
+  }
+};
+
+TEST_F(TreeClockTestFixture, lockHandOffMatchesVectorClocks) {
+  for (int round = 0; round < 50; round++) {
+    for (int t = 0; t < num_threads; t++) {
+      const int m = (t + round) % num_locks;
+      acquire(t, m);
+      release(t, m);
+      expectSameClocks();
+    }
+  }
+}
+
+TEST_F(TreeClockTestFixture, randomEventsMatchVectorClocks) {
+  std::mt19937 random(42);
+  for (int event = 0; event < 20000; event++) {
+    const int t = random() % num_threads;
+    const int other = random() % num_threads;
+    switch (random() % 3) {
+      case 0: acquire(t, other % num_locks); break;
+      case 1: release(t, other % num_locks); break; // may not hold it
+      case 2: if (t != other) fork(t, other); break;
+    }
+    expectSameClocks();
+    if (HasFatalFailure()) return;
+  }
+}
+
+TEST_F(TreeClockTestFixture, acquireOfKnownReleaseChangesNothing) {
+  acquire(0, 0);
+  release(0, 0);
+  acquire(1, 0);
+  const ThreadClock before = threads[1].C;
+
+  acquire(1, 0); // nothing new since
+  for (int u = 0; u < num_threads; u++) {
+    const ThreadClock & C = threads[1].C;
+    EXPECT_EQ(before[u], C[u]);
+  }
+  expectSameClocks();
+}
+
+TEST(TreeClockTest, entriesWrittenOutOfTreeOrderStillJoin) {
+  ThreadClock c1 = {EPOCH(0, 1), EPOCH(1, 4), EPOCH(2, 0)};
+  ThreadClock c2 = {EPOCH(0, 3), EPOCH(1, 2), EPOCH(2, 7)};
+
+  c1.join(c2);
+
+  const ThreadClock & C = c1;
+  EXPECT_EQ(EPOCH(0, 3), C[0]);
+  EXPECT_EQ(EPOCH(1, 4), C[1]);
+  EXPECT_EQ(EPOCH(2, 7), C[2]);
+}
@@ -0,0 +1,74 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+//
+// Unit tests for tsan_interface atomic operations.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "etsan/tsan_interface.h"
+
+TEST(TsanInterfaceAtomicTest, operationsReturnOldValues) {
+  volatile __tsan_atomic32 x = 6;
+
+  EXPECT_EQ(6, __tsan_atomic32_fetch_add(&x, 2, __tsan_memory_order_acq_rel));
+  EXPECT_EQ(8, __tsan_atomic32_fetch_sub(&x, 1, __tsan_memory_order_relaxed));
+  EXPECT_EQ(7, __tsan_atomic32_fetch_and(&x, 3, __tsan_memory_order_release));
+  EXPECT_EQ(3, __tsan_atomic32_fetch_or(&x, 4, __tsan_memory_order_acquire));
+  EXPECT_EQ(7, __tsan_atomic32_fetch_xor(&x, 1, __tsan_memory_order_seq_cst));
+  EXPECT_EQ(6, __tsan_atomic32_fetch_nand(&x, 2, __tsan_memory_order_seq_cst));
+  EXPECT_EQ(~2, __tsan_atomic32_exchange(&x, 5, __tsan_memory_order_seq_cst));
+  EXPECT_EQ(5, __tsan_atomic32_load(&x, __tsan_memory_order_acquire));
+}
+
+TEST(TsanInterfaceAtomicTest, compareExchangeStoresOnlyOnMatch) {
+  volatile __tsan_atomic64 x = 1LL << 40;
+
+  EXPECT_EQ(1LL << 40, __tsan_atomic64_compare_exchange_val(&x, 0, 1,
+      __tsan_memory_order_acq_rel, __tsan_memory_order_acquire));
+  EXPECT_EQ(1LL << 40, __tsan_atomic64_compare_exchange_val(&x, 1LL << 40, 1,
+      __tsan_memory_order_acq_rel, __tsan_memory_order_acquire));
+  EXPECT_EQ(1, __tsan_atomic64_load(&x, __tsan_memory_order_relaxed));
+}
+
+TEST(TsanInterfaceAtomicTest, concurrentIncrementsAreNotLost) {
+  volatile __tsan_atomic16 counter = 0;
+  auto increment = [&]() {
+    for (int i = 0; i < 1000; i++) {
+      __tsan_atomic16_fetch_add(&counter, 1, __tsan_memory_order_acq_rel);
+    }
+  };
+
+  std::thread other(increment);
+  increment();
+  other.join();
+
+  __tsan_atomic8 byte = 0;
+  __tsan_atomic8_store(&byte, 1, __tsan_memory_order_release);
+  EXPECT_EQ(1, __tsan_atomic8_load(&byte, __tsan_memory_order_acquire));
+  EXPECT_EQ(2000, __tsan_atomic16_load(&counter, __tsan_memory_order_seq_cst));
+}
+
+TEST(TsanInterfaceAtomicTest, fencesOrderRelaxedOperations) {
+  int data = 0;
+  volatile __tsan_atomic32 ready = 0;
+
+  std::thread producer([&]() {
+    data = 42;
+    __tsan_atomic_thread_fence(__tsan_memory_order_release);
+    __tsan_atomic32_store(&ready, 1, __tsan_memory_order_relaxed);
+  });
+  while (!__tsan_atomic32_load(&ready, __tsan_memory_order_relaxed)) {}
+  __tsan_atomic_thread_fence(__tsan_memory_order_acquire);
+  producer.join();
+
+  __tsan_atomic_signal_fence(__tsan_memory_order_seq_cst);
+  EXPECT_EQ(42, data);
+}
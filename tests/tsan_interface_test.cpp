@@ -19,7 +19,7 @@
 
 #include "etsan/tsan_interface.h"
 
-using func_t = std::function<void(void*, int, void*, void*)>;
+using func_t = std::function<void(void*, const __tsan_site*)>;
 
 // function-related data definitions
 struct data_t
@@ -34,9 +34,12 @@ struct data_t
 };
 
 void threadFunction(data_t & data) {
+  const __tsan_site site = {
+    (unsigned)data.line_no, data.file_name, data.func_name, data.func_name
+  };
   usleep(400);
-  data.ft_read_func(data.addr, data.line_no, data.func_name, data.file_name);
-  data.ft_write_func(data.addr, data.line_no, data.func_name, data.file_name);
+  data.ft_read_func(data.addr, &site);
+  data.ft_write_func(data.addr, &site);
 }
 
 constexpr int NUM_THREADS = 4;
@@ -127,6 +130,18 @@ TEST(TsanInterfaceTestFixture, CallingTsanInit) {
   ASSERT_TRUE(true);
 }
 
+TEST(TsanInterfaceTestFixture, CallingTsanFreeSizedOnForeignBlock) {
+  // a block of a custom allocator: malloc knows nothing of its size
+  alignas(8) static char pool[64];
+  const __tsan_site site = { 1, (char*)"pool.cpp", (char*)"f", (char*)"f" };
+  __tsan_write8(pool, &site);
+
+  __tsan_free_sized(pool, sizeof(pool));
+  __tsan_free_sized(nullptr, 0);
+  __tsan_free(nullptr);
+  ASSERT_TRUE(true);
+}
+
 TEST_P(TsanInterfaceTestFixture, CheckTsanRreadWithConcurrencyAndRace) {
   int func_id = GetParam();
   void* addr = (void*)(0x03 + func_id);
@@ -27,9 +27,12 @@ char * file_name = "some_file";
 
 void threadFunction() {
 
+  const __tsan_site site = {
+    (unsigned)line_num, file_name, func_name, func_name
+  };
   usleep(400);
-  __tsan_vptr_read(addr, line_num, func_name, file_name);
-  __tsan_vptr_update(addr, new_val, line_num, func_name, file_name);
+  __tsan_vptr_read(addr, &site);
+  __tsan_vptr_update(addr, new_val, &site);
 }
 
 constexpr int NUM_THREADS = 4;
@@ -75,3 +78,51 @@ TEST(TsanInterfaceTestFixture, CheckTsanRreadWriteVptrWithConcurrencyAndRace) {
   std::cout.rdbuf(cout_read_buffer);
   std::cout << input_capture.str() << std::endl;
 }
+
+TEST(TsanInterfaceTestFixture, CheckTsanVptrUpdateCoversWholePointer) {
+  alignas(16) static char object[16];
+  const int vptr_line = 456;
+  const __tsan_site write_site = {
+    (unsigned)line_num, file_name, func_name, func_name
+  };
+  const __tsan_site vptr_site = {
+    (unsigned)vptr_line, file_name, func_name, func_name
+  };
+
+  // redirect cout to a stream to capture output string
+  std::stringstream input_capture;
+  auto cout_read_buffer = std::cout.rdbuf();
+  std::cout.rdbuf(input_capture.rdbuf());
+
+  // the vptr starts in the first word, the other thread writes its end
+  std::thread writer([&]() {
+    usleep(400);
+    __tsan_write1(object + sizeof(void*), &write_site);
+  });
+  usleep(200);
+  auto writer_id = writer.get_id();
+  __tsan_thread_create((void*)(&writer_id));
+
+  std::thread updater([&]() {
+    usleep(1200);
+    __tsan_vptr_update((void**)(object + sizeof(void*) / 2), new_val,
+                       &vptr_site);
+  });
+  usleep(200);
+  auto updater_id = updater.get_id();
+  __tsan_thread_create((void*)(&updater_id));
+
+  writer.join();
+  __tsan_thread_join((void*)(&writer_id));
+  updater.join();
+  __tsan_thread_join((void*)(&updater_id));
+
+  __tsan_main_func_exit();
+
+  std::string line_no_report = std::string("At line number: ") + std::to_string(vptr_line);
+  EXPECT_NE(std::string::npos, input_capture.str().find(line_no_report));
+
+  // return back std::cout buffer
+  std::cout.rdbuf(cout_read_buffer);
+  std::cout << input_capture.str() << std::endl;
+}
@@ -0,0 +1,64 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Microbenchmark of vector clock join and copy: the SIMD kernels
+// against the scalar std::max loop they replace, for clocks of 4,
+// 16, 64 and 256 threads. Not a test: run it by hand.
+//
+////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+
+#include "etsan/defs.h"
+
+static const int kRounds = 1000000;
+
+static void scalarJoin(VectorClock & c1, const VectorClock & c2) {
+  for (std::size_t i = 0; i < c2.size(); i++) {
+    c1[i] = std::max(c1[i], c2[i]);
+  }
+}
+
+static void scalarCopy(VectorClock & c1, const VectorClock & c2) {
+  for (std::size_t i = 0; i < c2.size(); i++) {
+    c1[i] = c2[i];
+  }
+}
+
+template <typename Op>
+static double nsPerOp(Op op) {
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < kRounds; r++) {
+    op();
+    asm volatile("" ::: "memory"); // keep every round
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+    std::chrono::steady_clock::now() - start;
+  return elapsed.count() / kRounds;
+}
+
+int main() {
+  printf("%8s %12s %12s %12s %12s\n", "threads", "join ns",
+         "scalar ns", "copy ns", "scalar ns");
+
+  for (int threads : {4, 16, 64, 256}) {
+    VectorClock c1, c2;
+    newVectorClock(c1, threads);
+    newVectorClock(c2, threads);
+    for (int t = 0; t < threads; t++) c2[t] = EPOCH(t, t % 3);
+
+    double join = nsPerOp([&] { c1.join(c2); });
+    double sjoin = nsPerOp([&] { scalarJoin(c1, c2); });
+    double copy = nsPerOp([&] { c1.copy(c2); });
+    double scopy = nsPerOp([&] { scalarCopy(c1, c2); });
+
+    printf("%8d %12.2f %12.2f %12.2f %12.2f\n", threads, join, sjoin,
+           copy, scopy);
+  }
+  return 0;
+}
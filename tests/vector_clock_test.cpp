@@ -0,0 +1,180 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the padded vector clocks and their join kernels.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+#include "etsan/defs.h"
+
+TEST(VectorClockTest, entriesAreAlignedAndPadded) {
+  VectorClock clock;
+  newVectorClock(clock, 3);
+
+  EXPECT_EQ(0U, (uintptr_t)clock.data() % vclock::kAlign);
+  EXPECT_EQ(0U, clock.capacity() % VectorClock::kLanes);
+  for (std::size_t i = clock.size(); i < clock.capacity(); i++) {
+    EXPECT_EQ(0, clock[i]) << "padding entry " << i;
+  }
+}
+
+TEST(VectorClockTest, growingKeepsEntries) {
+  VectorClock clock;
+  for (int t = 0; t < 70; t++) clock.push_back(EPOCH(t, t));
+
+  ASSERT_EQ(70U, clock.size());
+  for (int t = 0; t < 70; t++) EXPECT_EQ(EPOCH(t, t), clock[t]);
+}
+
+TEST(VectorClockTest, joinTakesMaximumOfEachEntry) {
+  // sizes not a multiple of the SIMD lanes
+  for (int size : {1, 5, 9, 17, 70}) {
+    VectorClock c1, c2;
+    newVectorClock(c1, size);
+    newVectorClock(c2, size);
+    for (int t = 0; t < size; t++) {
+      c1[t] = EPOCH(t, t % 2 ? t : 0);
+      c2[t] = EPOCH(t, t % 2 ? 0 : t + 1);
+    }
+
+    c1.join(c2);
+
+    for (int t = 0; t < size; t++) {
+      EXPECT_EQ(EPOCH(t, t % 2 ? t : t + 1), c1[t]) << "size " << size;
+    }
+  }
+}
+
+TEST(VectorClockTest, joinOfShorterClockKeepsTail) {
+  VectorClock c1, c2;
+  newVectorClock(c1, 12);
+  newVectorClock(c2, 3);
+  c1[10] = EPOCH(10, 7);
+  c2[1] = EPOCH(1, 4);
+
+  c1.join(c2);
+
+  EXPECT_EQ(EPOCH(1, 4), c1[1]);
+  EXPECT_EQ(EPOCH(10, 7), c1[10]);
+}
+
+TEST(VectorClockTest, joinComparesHighThreadIdsUnsigned) {
+  // the top tid bit makes these epochs negative as signed values
+  const ThreadID tid = MAX_THREADS - 2;
+  VectorClock c1, c2;
+  newVectorClock(c1, tid + 1);
+  newVectorClock(c2, tid + 1);
+  c1[tid] = EPOCH(tid, 2);
+  c2[tid] = EPOCH(tid, 5);
+
+  c1.join(c2);
+  EXPECT_EQ(EPOCH(tid, 5), c1[tid]);
+  EXPECT_EQ(EPOCH(tid - 1, 0), c1[tid - 1]);
+}
+
+TEST(VectorClockTest, copyReplacesEntries) {
+  VectorClock c1, c2;
+  newVectorClock(c1, 9);
+  newVectorClock(c2, 9);
+  for (int t = 0; t < 9; t++) c2[t] = EPOCH(t, 3);
+
+  c1.copy(c2);
+
+  for (int t = 0; t < 9; t++) EXPECT_EQ(EPOCH(t, 3), c1[t]);
+}
+
+TEST(VectorClockTest, shrinkingZeroesDroppedEntries) {
+  VectorClock clock;
+  newVectorClock(clock, 8);
+  clock[6] = EPOCH(6, 1);
+
+  clock.resize(4);
+  clock.resize(8);
+
+  EXPECT_EQ(0, clock[6]);
+}
+
+TEST(VectorClockTest, sharedBufferIsCopiedOnJoin) {
+  VectorClock c1, c2, other;
+  newVectorClock(c1, 4);
+  newVectorClock(other, 4);
+  other[2] = EPOCH(2, 9);
+
+  c2.share(c1);
+  EXPECT_EQ(c1.data(), c2.data());
+  EXPECT_TRUE(c1.shared());
+
+  c1.join(other);
+
+  EXPECT_NE(c1.data(), c2.data());
+  EXPECT_FALSE(c2.shared());
+  EXPECT_EQ(EPOCH(2, 9), c1[2]);
+  EXPECT_EQ(EPOCH(2, 0), c2[2]);
+}
+
+TEST(VectorClockTest, lockClockKeepsEntryOfReleaser) {
+  VectorClock releaser;
+  newVectorClock(releaser, 3);
+  releaser[1] = EPOCH(1, 4);
+
+  LockClock lock;
+  lock.copyFrom(releaser, 1);
+  releaser[1] = EPOCH(1, 5); // next epoch of the releaser, in place
+
+  EXPECT_TRUE(releaser.shared()); // no copy at release
+  EXPECT_EQ(EPOCH(1, 4), lock.at(1));
+
+  VectorClock acquirer;
+  newVectorClock(acquirer, 3);
+  lock.joinInto(acquirer);
+  EXPECT_EQ(EPOCH(1, 4), acquirer[1]);
+}
+
+TEST(VectorClockTest, joinSkipsEntryOfOther) {
+  VectorClock c, other;
+  newVectorClock(c, 20);
+  newVectorClock(other, 20);
+  other[3] = EPOCH(3, 7);
+  other[9] = EPOCH(9, 8);
+  other[10] = EPOCH(10, 2);
+
+  c.join(other, 9);
+
+  EXPECT_EQ(EPOCH(3, 7), c[3]);
+  EXPECT_EQ(EPOCH(9, 0), c[9]);
+  EXPECT_EQ(EPOCH(10, 2), c[10]);
+}
+
+TEST(VectorClockTest, lockClockNeverReadsEntryOfReleaser) {
+  VectorClock releaser;
+  newVectorClock(releaser, 12);
+  releaser[11] = EPOCH(11, 3);
+
+  LockClock lock;
+  lock.copyFrom(releaser, 11);
+
+  // the releaser goes on in place while others join the lock
+  std::atomic<bool> done{false};
+  std::thread owner([&]() {
+    for (unsigned c = 4; !done; c = c % 1000 + 4) releaser[11] = EPOCH(11, c);
+  });
+  for (int i = 0; i < 1000; i++) {
+    VectorClock acquirer;
+    newVectorClock(acquirer, 12);
+    lock.joinInto(acquirer);
+    EXPECT_EQ(EPOCH(11, 3), acquirer[11]);
+  }
+  done = true;
+  owner.join();
+
+  lock.push_back(EPOCH(12, 0)); // a buffer of its own
+  EXPECT_EQ(EPOCH(11, 3), lock.at(11));
+}
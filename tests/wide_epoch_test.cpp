@@ -0,0 +1,69 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for 64-bit epochs (-DETSAN_WIDE_EPOCH).
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include "etsan/fasttrack.h"
+
+static_assert(sizeof(Epoch) == 8, "built without ETSAN_WIDE_EPOCH");
+
+TEST(WideEpochTestFixture, packsTidAndClock) {
+  const ThreadID tid = 1000;            // more than 8 bits of tid
+  const Epoch clock = (1LL << 30) + 5;  // more than 24 bits of clock
+  const Epoch epoch = EPOCH(tid, clock);
+
+  EXPECT_EQ(tid, TID(epoch));
+  EXPECT_EQ(clock, CLOCK(epoch));
+  EXPECT_NE(READ_SHARED, epoch);
+}
+
+TEST(WideEpochTestFixture, incrementPastCompactClockLimit) {
+  ThreadState thread_state;
+  thread_state.tid = 300;
+  newVectorClock(thread_state.C, thread_state.tid + 1);
+  thread_state.C[thread_state.tid] = EPOCH(thread_state.tid, 0x00FFFFFF);
+  thread_state.updateEpoch();
+
+  thread_state.increment();
+
+  EXPECT_EQ(thread_state.tid, TID(thread_state.epoch));
+  EXPECT_EQ(0x01000000, CLOCK(thread_state.epoch));
+}
+
+TEST(WideEpochTestFixture, raceBetweenHighThreadIds) {
+  constexpr ThreadID tid1 = 300;
+  constexpr ThreadID tid2 = 700;
+
+  ThreadState writer;
+  writer.tid = tid1;
+  newVectorClock(writer.C, tid2 + 1);
+  writer.C[tid1] = EPOCH(tid1, 1LL << 32);
+  writer.updateEpoch();
+
+  ThreadState reader;
+  reader.tid = tid2;
+  newVectorClock(reader.C, tid2 + 1);
+  reader.C[tid2] = EPOCH(tid2, 1);
+  reader.updateEpoch();
+
+  VarState variable_state;
+  variable_state.W = EPOCH(tid1, 0);
+  variable_state.R = EPOCH(tid1, 0);
+
+  EXPECT_FALSE(ft_write(variable_state, writer));
+  EXPECT_TRUE(ft_read(variable_state, reader));
+
+  // once the reader knows the write, there is no race
+  VarState ordered_state;
+  ordered_state.W = writer.epoch;
+  ordered_state.R = EPOCH(tid1, 0);
+  reader.C[tid1] = writer.epoch;
+  EXPECT_FALSE(ft_read(ordered_state, reader));
+}